@@ -0,0 +1,633 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+// Benchmarks of the command pipeline and the persistence layer.
+//
+// Usage: concordo_bench [USERS [SERVERS [CHANNELS [MESSAGES]]]]
+// where CHANNELS is the amount of text channels per server and MESSAGES the
+// amount of messages per channel. It runs on a temporary directory.
+//
+// The concurrency benchmark runs sessions in 1, 2, 4... threads, up to the
+// amount of cores, each one visualizing its own channel. The startup benchmark
+// loads the sharded files with as many threads.
+//
+// The compression benchmark loads the binary snapshot, with and without its
+// messages compressed, and lists the tail or the whole of a channel.
+//
+// The timestamps benchmark compares the codec of the dates with the stream
+// functions it replaced, per date converted.
+//
+// The allocations are counted by replacing the global operator new, and are
+// reported per message loaded, replayed from the journal or sent.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <new>
+#include <random>
+#include <span>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "system.h"
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+}  // namespace
+
+void* operator new(size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p{std::malloc(n == 0 ? 1 : n)}) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+// Not inlined, so the compiler doesn't pair std::free with the callers' new.
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+
+[[gnu::noinline]] void operator delete(void* p, size_t /*n*/) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+using concordo::System, concordo::MessageView, concordo::CommandLine;
+using std::string, std::string_view, std::vector, std::to_string;
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+namespace ranges = std::ranges;
+
+struct Workload {
+  size_t users{1000};
+  size_t servers{10};
+  size_t channels{5};   // Per server.
+  size_t messages{2000};  // Per channel.
+};
+
+// The latencies of every run of an operation, in nanoseconds.
+struct Stats {
+  vector<double> ns;
+
+  [[nodiscard]] double percentile(double p) const {
+    return ns[static_cast<size_t>(p * static_cast<double>(ns.size() - 1))];
+  }
+};
+
+// The report is written to the real standard output, while the output of the
+// system is discarded.
+std::ostream* report{nullptr};
+
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char* /*s*/, std::streamsize n) override {
+    return n;
+  }
+};
+
+template <typename Operation>
+Stats measure(size_t runs, Operation op) {
+  Stats s;
+  s.ns.reserve(runs);
+  for (size_t i{0}; i < runs; ++i) {
+    const auto start{Clock::now()};
+    op(i);
+    const std::chrono::duration<double, std::nano> elapsed{Clock::now() -
+                                                           start};
+    s.ns.push_back(elapsed.count());
+  }
+  ranges::sort(s.ns);
+  return s;
+}
+
+string format_ns(double ns) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  if (ns >= 1e6) {
+    out << ns / 1e6 << " ms";
+  } else if (ns >= 1e3) {
+    out << ns / 1e3 << " us";
+  } else {
+    out << ns << " ns";
+  }
+  return out.str();
+}
+
+void print(string_view name, const Stats& s) {
+  double total{0};
+  for (const double ns : s.ns) {
+    total += ns;
+  }
+  const double mean{total / static_cast<double>(s.ns.size())};
+  *report << std::left << std::setw(24) << name << std::right << std::setw(8)
+          << s.ns.size() << std::setw(12) << format_ns(mean) << std::setw(12)
+          << format_ns(s.percentile(0.5)) << std::setw(12)
+          << format_ns(s.percentile(0.9)) << std::setw(12)
+          << format_ns(s.percentile(0.99)) << std::setw(12)
+          << format_ns(s.ns.back()) << std::setw(14) << std::fixed
+          << std::setprecision(0) << 1e9 / mean << '\n';
+}
+
+void print_header() {
+  *report << std::left << std::setw(24) << "benchmark" << std::right
+          << std::setw(8) << "runs" << std::setw(12) << "mean"
+          << std::setw(12) << "p50" << std::setw(12) << "p90" << std::setw(12)
+          << "p99" << std::setw(12) << "max" << std::setw(14) << "ops/s"
+          << '\n';
+}
+
+string email(size_t user) { return "user" + to_string(user) + "@bench"; }
+string server_name(size_t server) { return "server" + to_string(server); }
+string channel_name(size_t channel) { return "channel" + to_string(channel); }
+
+// Builds the workload through journal records, as they don't depend on who's
+// logged in, and saves it as the snapshot.
+void generate(System& sys, const Workload& w, std::mt19937& rng) {
+  std::uniform_int_distribution<size_t> user(1, w.users);
+  const time_t start{1700000000};
+  for (size_t u{1}; u <= w.users; ++u) {
+    sys.apply_record("create-user " + to_string(u) + ' ' + email(u) +
+                     " pw User " + to_string(u));
+  }
+  for (size_t s{0}; s < w.servers; ++s) {
+    const string name{server_name(s)};
+    sys.apply_record("create-server 1 " + name);
+    for (size_t u{2}; u <= w.users; ++u) {
+      sys.apply_record("join-server " + name + ' ' + to_string(u));
+    }
+    for (size_t c{0}; c < w.channels; ++c) {
+      sys.apply_record("create-channel " + name + ' ' + channel_name(c) +
+                       " text");
+      const string prefix{"send-message " + name + ' ' + channel_name(c) +
+                          " text "};
+      for (size_t m{0}; m < w.messages; ++m) {
+        sys.apply_record(prefix + to_string(user(rng)) + ' ' +
+                         to_string(start + static_cast<time_t>(m) * 30) +
+                         " message number " + to_string(m) +
+                         " of a synthetic benchmark workload");
+      }
+    }
+  }
+  sys.save();
+}
+
+// Logs in and enters the first channel of the first server.
+void enter_channel(System& sys) {
+  sys.run({"login", email(1) + " pw"});
+  sys.run({"enter-server", server_name(0)});
+  sys.run({"enter-channel", channel_name(0)});
+}
+
+void bench_persistence(System::StorageFormat format, string_view name,
+                       size_t runs) {
+  System sys;
+  sys.set_format(format);
+  print(string(name) + " load", measure(runs, [&](size_t) { sys.load(); }));
+  print(string(name) + " save", measure(runs, [&](size_t) { sys.save(); }));
+  // A message is sent before every save, changing a single server.
+  sys.run({"begin-batch", ""});
+  enter_channel(sys);
+  print(string(name) + " save (1 change)", measure(runs, [&](size_t) {
+          sys.run({"send-message", "a message changing one server"});
+          sys.save();
+        }));
+}
+
+void bench_lookups(const Workload& w, std::mt19937& rng) {
+  System sys;
+  sys.load();
+  const size_t runs{200000};
+  std::uniform_int_distribution<size_t> user(1, w.users);
+  std::uniform_int_distribution<size_t> server(0, w.servers - 1);
+  vector<int> ids(runs);
+  vector<string> emails(runs);
+  vector<string> names(runs);
+  for (size_t i{0}; i < runs; ++i) {
+    ids[i] = static_cast<int>(user(rng));
+    emails[i] = email(user(rng));
+    names[i] = server_name(server(rng));
+  }
+  size_t found{0};
+  print("find_user(id)", measure(runs, [&](size_t i) {
+          found += sys.find_user(ids[i])->getId() > 0 ? 1U : 0U;
+        }));
+  print("find_user(email)", measure(runs, [&](size_t i) {
+          found += sys.find_user(emails[i])->getId() > 0 ? 1U : 0U;
+        }));
+  print("find_server", measure(runs, [&](size_t i) {
+          found += sys.find_server(names[i])->has_invite() ? 0U : 1U;
+        }));
+  if (found != runs * 3) {
+    *report << "lookups failed\n";
+  }
+}
+
+void bench_messages(const Workload& w, std::mt19937& rng) {
+  System sys;
+  sys.load();
+  enter_channel(sys);
+  const size_t runs{20000};
+  print("list_messages (tail 50)",
+        measure(1000, [&](size_t) { sys.list_messages("50"); }));
+  print("list_messages (all)",
+        measure(20, [&](size_t) { sys.list_messages(""); }));
+  std::uniform_int_distribution<int> user(1, static_cast<int>(w.users));
+  const string content{"a message sent while benchmarking"};
+  print("print_message", measure(runs, [&](size_t i) {
+          sys.print_message(
+              {static_cast<time_t>(1700000000 + i), user(rng), content});
+        }));
+  print("send_message", measure(runs, [&](size_t) {
+          sys.run({"send-message", content});
+        }));
+  // Every command waits for the disk, as the default journal does with sync.
+  print("send_message + sync", measure(runs / 10, [&](size_t) {
+          sys.run({"send-message", content});
+          sys.run({"sync", ""});
+        }));
+
+  // The journal is written by another thread, grouping the records.
+  System queued;
+  queued.set_flush_policy({256, std::chrono::milliseconds{10}});
+  queued.load();
+  enter_channel(queued);
+  print("send_message (queued)", measure(runs, [&](size_t) {
+          queued.run({"send-message", content});
+        }));
+}
+
+// Runs the same command in every session, each in its own thread, and reports
+// the throughput of all of them together.
+void bench_scaling(System& sys, vector<System::Session>& sessions,
+                   string_view name, const CommandLine& cl,
+                   size_t runs) {
+  const size_t max_threads{sessions.size()};
+  for (size_t threads{1}; threads <= max_threads; threads *= 2) {
+    std::latch ready{static_cast<std::ptrdiff_t>(threads + 1)};
+    vector<std::jthread> workers;
+    for (size_t t{0}; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        ready.arrive_and_wait();
+        for (size_t i{0}; i < runs; ++i) {
+          sys.run(sessions[t], cl);
+        }
+      });
+    }
+    ready.arrive_and_wait();
+    const auto start{Clock::now()};
+    workers.clear();
+    const std::chrono::duration<double> elapsed{Clock::now() - start};
+    const double ops{static_cast<double>(runs * threads)};
+    *report << std::left << std::setw(24) << name << std::right
+            << std::setw(8) << threads << std::setw(12) << runs * threads
+            << std::setw(12) << format_ns(elapsed.count() * 1e9)
+            << std::setw(14) << std::fixed << std::setprecision(0)
+            << ops / elapsed.count() << '\n';
+  }
+}
+
+// Every session logs in as another user and enters another channel, so only
+// the locks of the system as a whole are shared.
+void bench_concurrency(const Workload& w) {
+  System sys;
+  sys.load();
+  const size_t cores{std::max(1U, std::thread::hardware_concurrency())};
+  const size_t max_threads{std::min({cores, w.users, w.servers * w.channels})};
+  NullBuffer discarded;
+  std::ostream null_output{&discarded};
+  vector<System::Session> sessions(max_threads);
+  for (size_t t{0}; t < max_threads; ++t) {
+    System::Session& s{sessions[t]};
+    s.output = &null_output;
+    sys.run(s, {"login", email(t + 1) + " pw"});
+    sys.run(s, {"enter-server", server_name(t % w.servers)});
+    sys.run(s, {"enter-channel", channel_name(t / w.servers)});
+    // The batches keep the journal, which every change waits for, out of it.
+    sys.run(s, {"begin-batch", ""});
+  }
+
+  *report << '\n'
+          << std::left << std::setw(24) << "concurrency" << std::right
+          << std::setw(8) << "threads" << std::setw(12) << "ops"
+          << std::setw(12) << "elapsed" << std::setw(14) << "ops/s" << '\n';
+  bench_scaling(sys, sessions, "send_message", {"send-message", "a message"},
+                20000);
+  bench_scaling(sys, sessions, "list_messages (tail 50)",
+                {"list-messages", "50"}, 2000);
+  bench_scaling(sys, sessions, "list_channels", {"list-channels", ""}, 20000);
+}
+
+// Reports the allocations made by an operation, per message it handles.
+template <typename Operation>
+void count_allocations(string_view name, size_t messages, Operation op) {
+  const size_t before{allocations.load()};
+  op();
+  const double n{static_cast<double>(allocations.load() - before)};
+  *report << std::left << std::setw(24) << name << std::right
+          << std::setw(12) << messages << std::setw(16) << std::fixed
+          << std::setprecision(2) << n / static_cast<double>(messages) << '\n';
+}
+
+// Loading counts the messages of every channel being read, as the stored ones
+// are only read when they're needed.
+void bench_allocations(const Workload& w) {
+  *report << '\n'
+          << std::left << std::setw(24) << "allocations" << std::right
+          << std::setw(12) << "messages" << std::setw(16) << "per message"
+          << '\n';
+  const size_t messages{w.servers * w.channels * w.messages};
+  for (const auto& [format, name] :
+       {std::pair{System::StorageFormat::kText, "text load"},
+        std::pair{System::StorageFormat::kBinary, "binary load"}}) {
+    System sys;
+    sys.set_format(format);
+    count_allocations(name, messages, [&] {
+      sys.load();
+      sys.run({"login", email(1) + " pw"});
+      for (size_t s{0}; s < w.servers; ++s) {
+        sys.run({"enter-server", server_name(s)});
+        for (size_t c{0}; c < w.channels; ++c) {
+          sys.run({"enter-channel", channel_name(c)});
+          sys.run({"list-messages", "1"});
+        }
+      }
+    });
+  }
+
+  const size_t runs{20000};
+  System sys;
+  sys.load();
+  enter_channel(sys);
+  const string prefix{"send-message " + server_name(0) + ' ' +
+                      channel_name(0) + " text 1 1700000000 "};
+  vector<string> records(runs, prefix + "a message replayed while benchmarking");
+  count_allocations("journal replay", runs, [&] {
+    for (const string& r : records) {
+      sys.apply_record(r);
+    }
+  });
+  sys.run({"begin-batch", ""});
+  const CommandLine cl{"send-message", "a message sent while benchmarking"};
+  count_allocations("send_message", runs, [&] {
+    for (size_t i{0}; i < runs; ++i) {
+      sys.run(cl);
+    }
+  });
+}
+
+// Every load reads the whole history of the servers, a file per thread.
+void bench_startup() {
+  const size_t cores{std::max(1U, std::thread::hardware_concurrency())};
+  *report << '\n'
+          << std::left << std::setw(24) << "startup" << std::right
+          << std::setw(8) << "threads" << std::setw(12) << "runs"
+          << std::setw(12) << "mean" << std::setw(14) << "speedup" << '\n';
+  double single{0};
+  for (size_t threads{1}; threads <= cores; threads *= 2) {
+    System sys;
+    sys.set_format(System::StorageFormat::kSharded);
+    sys.set_load_threads(threads);
+    const Stats s{measure(10, [&](size_t) { sys.load(); })};
+    double total{0};
+    for (const double ns : s.ns) {
+      total += ns;
+    }
+    const double mean{total / static_cast<double>(s.ns.size())};
+    single = threads == 1 ? mean : single;
+    *report << std::left << std::setw(24) << "sharded load" << std::right
+            << std::setw(8) << threads << std::setw(12) << s.ns.size()
+            << std::setw(12) << format_ns(mean) << std::setw(13)
+            << std::fixed << std::setprecision(2) << single / mean << "x\n";
+  }
+}
+
+// The snapshot is written again with its messages compressed, so this runs
+// last. The tail and all rows load the snapshot and then list the messages of
+// a channel. Listing its tail only reads the stored messages in it, which are
+// in the last block when compressed.
+void bench_compression() {
+  const auto bench = [](string_view name, bool compress) {
+    const auto load = [compress](System& sys) {
+      sys.set_format(System::StorageFormat::kBinary);
+      sys.set_compression(compress);
+      sys.load();
+    };
+    print(string(name) + " load", measure(10, [&](size_t) {
+            System sys;
+            load(sys);
+          }));
+    print(string(name) + " tail 50", measure(10, [&](size_t) {
+            System sys;
+            load(sys);
+            enter_channel(sys);
+            sys.list_messages("50");
+          }));
+    print(string(name) + " all", measure(10, [&](size_t) {
+            System sys;
+            load(sys);
+            enter_channel(sys);
+            sys.list_messages("");
+          }));
+  };
+  *report << '\n';
+  print_header();
+  const auto plain{fs::file_size("concordo.snap")};
+  bench("binary", false);
+  {
+    System sys;
+    sys.set_format(System::StorageFormat::kBinary);
+    sys.set_compression(true);
+    sys.load();
+    sys.save();
+  }
+  const auto compressed{fs::file_size("concordo.snap")};
+  bench("compressed", true);
+  *report << "\nsnapshot: " << plain << " bytes, compressed: " << compressed
+          << " bytes (" << std::fixed << std::setprecision(2)
+          << static_cast<double>(plain) / static_cast<double>(compressed)
+          << "x smaller)\n";
+}
+
+// Keeps a tenth of the messages of every channel, moving the rest to the
+// archive, so loading and saving only handle the ones kept.
+void bench_retention(const Workload& w) {
+  *report << '\n';
+  print_header();
+  const auto before{fs::file_size("servers.txt")};
+  {
+    System sys;
+    sys.load();
+    const string policy{
+        " \"\" count=" + to_string(std::max<size_t>(w.messages / 10, 1)) +
+        " age=0"};
+    for (size_t s{0}; s < w.servers; ++s) {
+      sys.apply_record("set-retention " + server_name(s) + policy);
+    }
+    print("archiving save", measure(1, [&](size_t) { sys.save(); }));
+  }
+  bench_persistence(System::StorageFormat::kText, "hot", 10);
+  {
+    System sys;
+    sys.load();
+    enter_channel(sys);
+    print("archived tail 50",
+          measure(10, [&](size_t) { sys.list_archived_messages("50"); }));
+  }
+  *report << "\nservers.txt: " << before
+          << " bytes, with retention: " << fs::file_size("servers.txt")
+          << " bytes, archive: " << fs::file_size("archive.dat") << " bytes\n";
+}
+
+// The functions the timestamp codec replaced, as they were.
+string stream_time_to_string(time_t t) {
+  std::ostringstream out;
+  out << std::put_time(std::localtime(&t), "%d/%m/%Y - %H:%M");
+  return out.str();
+}
+
+time_t stream_string_to_time(string_view s) {
+  std::stringstream ss{string(s)};
+  std::tm tm{};
+  tm.tm_isdst = -1;
+  ss >> std::get_time(&tm, "%d/%m/%Y - %H:%M");
+  return std::mktime(&tm);
+}
+
+// Every run converts a batch of dates spread over some years, so the display
+// formatter mostly formats new minutes.
+void bench_timestamps(std::mt19937& rng) {
+  *report << '\n'
+          << std::left << std::setw(24) << "timestamps" << std::right
+          << std::setw(8) << "runs" << std::setw(12) << "per date"
+          << std::setw(14) << "speedup" << '\n';
+  const size_t batch{1000};
+  std::uniform_int_distribution<time_t> spread{1600000000, 1900000000};
+  vector<time_t> dates(batch);
+  ranges::generate(dates, [&] { return spread(rng); });
+  vector<string> iso;
+  vector<string> shown;
+  for (const time_t t : dates) {
+    iso.push_back(concordo::time_to_string(t));
+    shown.push_back(stream_time_to_string(t));
+  }
+
+  size_t sink{0};
+  double baseline{0};
+  const auto row = [&](string_view name, bool stream, auto convert) {
+    const Stats s{measure(200, [&](size_t) {
+      for (size_t i{0}; i < batch; ++i) {
+        sink += static_cast<size_t>(convert(i));
+      }
+    })};
+    double total{0};
+    for (const double ns : s.ns) {
+      total += ns;
+    }
+    const double mean{total / static_cast<double>(s.ns.size() * batch)};
+    baseline = stream ? mean : baseline;
+    *report << std::left << std::setw(24) << name << std::right
+            << std::setw(8) << s.ns.size() << std::setw(12) << format_ns(mean)
+            << std::setw(13) << std::fixed << std::setprecision(2)
+            << baseline / mean << "x\n";
+  };
+  concordo::TimeFormatter formatter;
+  std::array<char, concordo::kIsoTimeLength> buffer{};
+  row("format (stream)", true,
+      [&](size_t i) { return stream_time_to_string(dates[i]).size(); });
+  row("format (display)", false,
+      [&](size_t i) { return formatter.format(dates[i]).size(); });
+  row("write_iso_time", false, [&](size_t i) {
+    return concordo::write_iso_time(dates[i], buffer.data()) - buffer.data();
+  });
+  row("parse (stream)", true,
+      [&](size_t i) { return stream_string_to_time(shown[i]); });
+  row("parse_local_time", false, [&](size_t i) {
+    return concordo::parse_local_time(shown[i]).value_or(0);
+  });
+  row("parse_iso_time", false, [&](size_t i) {
+    return concordo::parse_iso_time(iso[i]).value_or(0);
+  });
+  if (sink == 0) {
+    *report << "No date was converted\n";
+  }
+}
+
+size_t parse_size(string_view s, size_t fallback) {
+  size_t n{};
+  auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+  return ec == std::errc{} && n > 0 ? n : fallback;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Workload w;
+  const std::span args(argv, argv + argc);
+  vector<size_t*> sizes{&w.users, &w.servers, &w.channels, &w.messages};
+  for (size_t i{1}; i < args.size() && i <= sizes.size(); ++i) {
+    *sizes[i - 1] = parse_size(args[i], *sizes[i - 1]);
+  }
+
+  const fs::path dir{fs::temp_directory_path() / "concordo_bench"};
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  const fs::path previous{fs::current_path()};
+  fs::current_path(dir);
+
+  std::ostream out{std::cout.rdbuf()};
+  report = &out;
+  NullBuffer discarded;
+  std::streambuf* const cerr_buffer{std::cerr.rdbuf()};
+  std::cout.rdbuf(&discarded);
+  std::cerr.rdbuf(&discarded);
+
+  *report << "Workload: " << w.users << " users, " << w.servers
+          << " servers, " << w.channels << " channels per server, "
+          << w.messages << " messages per channel\n\n";
+  std::mt19937 rng{42};
+  {
+    System sys;
+    generate(sys, w, rng);
+    sys.set_format(System::StorageFormat::kBinary);
+    sys.save();
+    sys.set_format(System::StorageFormat::kSharded);
+    sys.save();
+  }
+
+  print_header();
+  bench_persistence(System::StorageFormat::kText, "text", 10);
+  bench_persistence(System::StorageFormat::kBinary, "binary", 10);
+  bench_persistence(System::StorageFormat::kSharded, "sharded", 10);
+  bench_lookups(w, rng);
+  bench_messages(w, rng);
+  bench_concurrency(w);
+  bench_startup();
+  bench_timestamps(rng);
+  bench_allocations(w);
+  bench_compression();
+  bench_retention(w);
+
+  std::cout.rdbuf(out.rdbuf());
+  std::cerr.rdbuf(cerr_buffer);
+  fs::current_path(previous);
+  fs::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,117 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "channels.h"
+
+namespace concordo {
+
+using std::string, std::string_view;
+
+/*! A class that represents the archive of the messages that the retention
+ *  policies took out of the text channels.
+ *
+ *  The archive is an append-only file of compressed blocks, each one holding
+ *  messages of a single channel, in the order they were sent. It's never
+ *  loaded with the system, only read by the queries of archived messages,
+ *  which decompress the blocks of their channel and skip the others.
+ *
+ *  The archive counts the messages of each channel, which the channels count
+ *  too, so the messages a save archived before it failed are known.
+ *
+ *  The blocks are only appended while the system is held exclusively, or
+ *  while the server list is, so they're never appended at once.
+ *  @see RetentionPolicy; concordo::System::apply_retention()
+ */
+class Archive {
+ public:
+  /*! The size a block of messages reaches before it's compressed, which is
+   *  as far back as the codec copies from.
+   */
+  static constexpr size_t kBlockSize{64 * 1024};
+
+  /*! A constructor to be used by the system.
+   *  @param filename the path of the archive file
+   */
+  explicit Archive(string_view filename) : filename_{filename} {}
+
+  /*! @see filename_ */
+  [[nodiscard]] const string& filename() const { return filename_; }
+
+  /*! Adds a message of a channel to the block being built, to be appended
+   *  by the next write(). The messages of a channel must be added in order.
+   *
+   *  The block is compressed once it reaches kBlockSize, or when a message
+   *  of another channel is added.
+   */
+  void add(string_view server, string_view channel, const MessageView& m);
+
+  /*! Appends every block added since the last call to the file, and syncs it
+   *  to the disk.
+   *  @return False if they couldn't be appended, in which case the file is
+   *  left as it was and they're discarded
+   *  @see append_file()
+   */
+  bool write();
+
+  /*! Appends a tombstone of a server that is being removed, and syncs it to
+   *  the disk, so the blocks of its channels aren't read anymore, even if
+   *  another server gets its name.
+   *  @return False if it couldn't be appended
+   */
+  bool forget(string_view server);
+
+  /*! Reads the archived messages of a channel, in the order they were sent,
+   *  passing each one to the visitor.
+   */
+  void for_each(string_view server, string_view channel,
+                const std::function<void(const MessageView&)>& visitor) const;
+
+  /*! @return The amount of messages of a channel written to the file since
+   *  its server was last forgotten
+   *  @see count()
+   */
+  [[nodiscard]] size_t archived(string_view server, string_view channel);
+
+ private:
+  /*! The amount of messages of each channel, by server and then by channel
+   *  name.
+   */
+  using Counts = std::map<string, std::map<string, size_t, std::less<>>,
+                          std::less<>>;
+
+  string filename_;
+  string pending_; /*!< The blocks compressed, not written yet. */
+  string server_;  /*!< The server of the block being built. */
+  string channel_; /*!< The channel of the block being built. */
+  string block_;   /*!< The messages added, not compressed into a block yet. */
+  uint32_t block_messages_{}; /*!< The amount of messages in block_. */
+  Counts counts_; /*!< The messages in the file. @see count() */
+  Counts pending_counts_; /*!< The messages in pending_. */
+  bool counted_{false}; /*!< If counts_ was read from the file. */
+
+  /*! Compresses the messages added into a block, if there's any. */
+  void flush_block();
+
+  /*! Reads the headers of the blocks in the file into counts_, the first time
+   *  it's called, so they're counted before anything is appended to it.
+   *
+   *  A block that can't be read whole is cut off the file, as it can only be
+   *  the last one, cut by a crash, and would hide the ones appended after it.
+   */
+  void count();
+};
+
+}  // namespace concordo
+
+#endif  // ARCHIVE_H
@@ -6,22 +6,55 @@
 #define CHANNELS_H
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <ranges>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
+#include "search.h"
+#include "snapshot.h"
+#include "timestamp.h"
+
 namespace concordo {
 
-using std::string, std::string_view, std::vector, std::cout, std::fstream;
+using std::string, std::string_view, std::vector, std::ostream, std::fstream,
+    std::shared_ptr, std::unique_ptr;
 using std::chrono::system_clock;
 
+/*! The allocator of the details read while loading the system.
+ *
+ *  They come from an arena that is discarded at once, after they are built
+ *  into the system, so the temporary strings aren't allocated one by one.
+ *  @see concordo::System::load_servers()
+ */
+using DetailsAllocator = std::pmr::polymorphic_allocator<>;
+
 struct MessageDetails {
   time_t date_time;
   int sender_id;
-  string content;
+  std::pmr::string content;
+};
+
+/*! A struct that refers to a message without owning its content.
+ *  @see Message; MessageSource
+ */
+struct MessageView {
+  time_t date_time;
+  int sender_id;
+  string_view content;
 };
 
 /*! A class that represents a message sent in a channel.
@@ -40,6 +73,8 @@ class Message {
       : sender_id_{sender_id}, content_{content} {}
   explicit Message(const MessageDetails &d)
       : date_time_{d.date_time}, sender_id_{d.sender_id}, content_{d.content} {}
+  explicit Message(const MessageView &v)
+      : date_time_{v.date_time}, sender_id_{v.sender_id}, content_{v.content} {}
 
   /*! @see date_time_ */
   [[nodiscard]] time_t getDateTime() const { return date_time_; }
@@ -52,7 +87,12 @@ class Message {
 
   [[nodiscard]] bool empty() const { return content_.empty(); }
 
-  void save(fstream &f);
+  [[nodiscard]] MessageView view() const {
+    return {date_time_, sender_id_, content_};
+  }
+
+  void save(fstream &f) const;
+  void save(SnapshotWriter &w) const;
 
  private:
   time_t date_time_{
@@ -62,10 +102,353 @@ class Message {
   string content_;  /*!< The content written into the message. */
 };
 
+/*! A struct that selects a range of the messages of a channel.
+ *
+ *  Only the messages sent in [after, before) are selected. Of those, the
+ *  newest offset messages are skipped, and the newest limit messages left are
+ *  the selected ones.
+ *  @see TextChannel::select()
+ */
+struct MessageRange {
+  size_t limit{std::numeric_limits<size_t>::max()};
+  size_t offset{};
+  time_t after{std::numeric_limits<time_t>::min()};
+  time_t before{std::numeric_limits<time_t>::max()};
+};
+
+/*! A struct that limits which messages a text channel keeps, past which
+ *  they're moved to the archive.
+ *
+ *  A limit of 0 doesn't limit anything.
+ *  @see TextChannel::for_each_expired(); concordo::Archive
+ */
+struct RetentionPolicy {
+  size_t max_messages{}; /*!< How many of the newest messages are kept. */
+  std::chrono::days max_age{}; /*!< How old the messages kept can be. */
+
+  [[nodiscard]] bool limited() const {
+    return max_messages > 0 || max_age.count() > 0;
+  }
+};
+
+class MessageLog;
+
+/*! A forward iterator over the messages of a log.
+ *  @see MessageLog
+ */
+class MessageLogIterator {
+ public:
+  using value_type = MessageView;
+  using difference_type = std::ptrdiff_t;
+
+  MessageLogIterator() = default;
+  MessageLogIterator(const MessageLog *log, size_t chunk, size_t pos)
+      : log_{log}, chunk_{chunk}, pos_{pos} {}
+
+  MessageView operator*() const;
+  MessageLogIterator &operator++();
+  MessageLogIterator operator++(int) {
+    MessageLogIterator it{*this};
+    ++*this;
+    return it;
+  }
+  bool operator==(const MessageLogIterator &) const = default;
+
+ private:
+  const MessageLog *log_{};
+  size_t chunk_{};
+  size_t pos_{};
+};
+
+/*! A class that stores the messages of a text channel as a segmented log.
+ *
+ *  The messages are appended to fixed-size chunks, each one with a compact
+ *  header per message and a contiguous arena holding their contents. A chunk
+ *  is never moved nor grown once allocated, so appending a message never
+ *  relocates the older ones, and the views to them stay valid.
+ *  @see TextChannel::messages_; MessageView
+ */
+class MessageLog {
+ public:
+  static constexpr size_t kChunkMessages{
+      1024}; /*!< The maximum amount of messages in a chunk. */
+  static constexpr size_t kArenaSize{
+      64 * 1024}; /*!< The size of a chunk's arena, unless a single message is
+                     bigger than it. */
+
+  using Iterator = MessageLogIterator;
+  using Slice = std::ranges::subrange<Iterator>;
+
+  MessageLog() = default;
+  MessageLog(const MessageLog &) = delete;
+  MessageLog(MessageLog &&) = default;
+  MessageLog &operator=(const MessageLog &) = delete;
+  MessageLog &operator=(MessageLog &&) = default;
+  ~MessageLog() = default;
+
+  void push_back(const MessageView &m);
+
+  [[nodiscard]] size_t size() const { return size_; }
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+  /*! Gets the message in the input position, finding its chunk with a binary
+   *  search.
+   */
+  [[nodiscard]] MessageView operator[](size_t i) const;
+
+  [[nodiscard]] Iterator begin() const { return iterator_at(0); }
+  [[nodiscard]] Iterator end() const { return iterator_at(size_); }
+
+  /*! @return The messages in the positions [first, last) */
+  [[nodiscard]] Slice slice(size_t first, size_t last) const {
+    return {iterator_at(first), iterator_at(last)};
+  }
+
+  /*! As the messages are appended in the order they're sent, which is the
+   *  order of their dates, it's found with binary searches.
+   *  @return The positions [first, last) of the messages sent in
+   *  [after, before)
+   */
+  [[nodiscard]] std::pair<size_t, size_t> sent_between(time_t after,
+                                                       time_t before) const;
+
+  /*! Selects a range of the messages, in the order they were sent, so no
+   *  message out of it is visited.
+   *  @see MessageRange; sent_between()
+   */
+  [[nodiscard]] Slice select(const MessageRange &r) const;
+
+ private:
+  /*! The compact header of a message. Its content ends where the content of
+   *  the next one begins.
+   */
+  struct Header {
+    time_t date_time;
+    int32_t sender_id;
+    uint32_t offset; /*!< The beginning of the content in the arena. */
+  };
+
+  struct Chunk {
+    vector<Header> headers;
+    unique_ptr<char[]> arena;
+    size_t capacity{}; /*!< The size of the arena. */
+    size_t used{};     /*!< The bytes of the arena used by the contents. */
+
+    [[nodiscard]] MessageView at(size_t pos) const;
+  };
+
+  friend MessageLogIterator;
+
+  vector<unique_ptr<Chunk>> chunks_;
+  vector<size_t> starts_; /*!< The position of the first message of each
+                             chunk in the log. */
+  size_t size_{};
+
+  [[nodiscard]] Iterator iterator_at(size_t i) const;
+};
+
+/*! An interface to the messages of a text channel that are still stored in
+ *  a file, so they are only read when they are needed.
+ *
+ *  If the file can't be read, no message is passed to the visitors, and the
+ *  source is kept, so the messages are never taken as read.
+ *  @see TextChannel::load_messages()
+ */
+class MessageSource : public std::enable_shared_from_this<MessageSource> {
+ public:
+  MessageSource() = default;
+  MessageSource(const MessageSource &) = delete;
+  MessageSource(MessageSource &&) = delete;
+  MessageSource &operator=(const MessageSource &) = delete;
+  MessageSource &operator=(MessageSource &&) = delete;
+  virtual ~MessageSource() = default;
+
+  /*! @return The amount of stored messages */
+  [[nodiscard]] virtual size_t size() const = 0;
+
+  /*! Reads every stored message, in order, passing each one to the visitor.
+   *  @return False if they couldn't be read
+   */
+  virtual bool for_each(
+      const std::function<void(const MessageView &)> &visitor) const = 0;
+
+  /*! Reads the last stored messages, in order, passing each one to the
+   *  visitor.
+   *
+   *  The messages are read in whole blocks, so more of them than wanted may
+   *  be read. Unless the source is split into blocks, every message is read.
+   *  @param n the amount of messages wanted
+   *  @return The messages stored before the ones read, or nullptr if every
+   *  message was read, or the source itself if they couldn't be read
+   */
+  virtual shared_ptr<const MessageSource> for_each_last(
+      size_t n, const std::function<void(const MessageView &)> &visitor) const;
+
+  /*! Reads the first stored messages, in order, while they're among the
+   *  first n or were sent before a date, passing each one to the visitor.
+   *
+   *  The messages are read up to the first one that is neither, so the
+   *  newer ones aren't read.
+   *  @return The amount of messages passed
+   */
+  virtual size_t for_each_first(
+      size_t n, time_t before,
+      const std::function<void(const MessageView &)> &visitor) const = 0;
+
+  /*! @return The stored messages but the first n, or nullptr if there's
+   *  none left
+   */
+  [[nodiscard]] virtual shared_ptr<const MessageSource> drop_first(
+      size_t n) const = 0;
+
+  /*! Adds every stored message to a snapshot being written.
+   *  @return False if they couldn't be read
+   */
+  virtual bool save(SnapshotWriter &w) const;
+};
+
+/*! A text file of servers, shared by the channels whose messages are stored
+ *  in it.
+ *
+ *  It's only open while their messages are read, so the files of the servers
+ *  that aren't read hold no descriptor, unless it's pinned.
+ *  @see TextMessageSource; concordo::System::load_shards()
+ */
+class MessageFile {
+ public:
+  explicit MessageFile(string filename) : filename_{std::move(filename)} {}
+
+  /*! @see filename_ */
+  [[nodiscard]] const string &filename() const { return filename_; }
+
+  /*! Keeps the file open from now on, so its messages are still read from it
+   *  once a newer file replaces it.
+   *  @return False if it couldn't be opened
+   */
+  bool pin();
+
+  /*! Opens the file, unless it's pinned, and passes it to the reader. Only a
+   *  file is read at once.
+   *  @return False if it couldn't be opened
+   */
+  bool read(const std::function<void(fstream &)> &reader);
+
+ private:
+  string filename_;
+  unique_ptr<fstream> stream_; /*!< The file, while it's open. */
+  bool pinned_{false};
+};
+
+/*! The messages of a channel stored in a text file of servers.
+ *  @see concordo::parse_channel_details()
+ */
+class TextMessageSource : public MessageSource {
+ public:
+  /*! @param f the file, which is shared by every channel read from it
+   *  @param pos the position of the first message in the file
+   *  @param size the amount of messages
+   *  @param skip the amount of messages at pos that were dropped
+   */
+  TextMessageSource(shared_ptr<MessageFile> f, std::streampos pos,
+                    size_t size, size_t skip = 0)
+      : file_{std::move(f)}, pos_{pos}, size_{size}, skip_{skip} {}
+
+  [[nodiscard]] size_t size() const override { return size_; }
+  bool for_each(
+      const std::function<void(const MessageView &)> &visitor) const override;
+  size_t for_each_first(
+      size_t n, time_t before,
+      const std::function<void(const MessageView &)> &visitor) const override;
+  [[nodiscard]] shared_ptr<const MessageSource> drop_first(
+      size_t n) const override;
+
+ private:
+  shared_ptr<MessageFile> file_;
+  std::streampos pos_;
+  size_t size_;
+  size_t skip_; /*!< The messages skipped before the first one, which are
+                   dropped without reading the file. */
+
+  /*! Opens the file at the first message.
+   *  @see MessageFile::read()
+   */
+  bool read(const std::function<void(fstream &)> &reader) const;
+};
+
+/*! The messages of a channel stored in a mapped binary snapshot.
+ *  @see Snapshot
+ */
+class SnapshotMessageSource : public MessageSource {
+ public:
+  SnapshotMessageSource(shared_ptr<const Snapshot> s, const ChannelRecord &r)
+      : snapshot_{std::move(s)}, record_{r} {}
+
+  [[nodiscard]] size_t size() const override { return record_.messages_count; }
+  bool for_each(
+      const std::function<void(const MessageView &)> &visitor) const override;
+  size_t for_each_first(
+      size_t n, time_t before,
+      const std::function<void(const MessageView &)> &visitor) const override;
+  [[nodiscard]] shared_ptr<const MessageSource> drop_first(
+      size_t n) const override;
+
+ private:
+  shared_ptr<const Snapshot> snapshot_;
+  ChannelRecord record_;
+};
+
+/*! The messages of a channel stored in compressed blocks of a mapped binary
+ *  snapshot.
+ *
+ *  A block is only decompressed when its messages are read, so reading the
+ *  last messages decompresses the last blocks only, and the blocks that
+ *  weren't read are written to a new snapshot as they are. Likewise, reading
+ *  the first messages sent before a date decompresses no block sent after
+ *  it.
+ *  @see BlockRecord; SnapshotWriter::SnapshotWriter(bool)
+ */
+class CompressedMessageSource : public MessageSource {
+ public:
+  /*! @param skip the amount of messages of the first block dropped */
+  CompressedMessageSource(shared_ptr<const Snapshot> s,
+                          std::span<const BlockRecord> blocks,
+                          size_t skip = 0);
+
+  [[nodiscard]] size_t size() const override { return size_; }
+  bool for_each(
+      const std::function<void(const MessageView &)> &visitor) const override;
+  shared_ptr<const MessageSource> for_each_last(
+      size_t n,
+      const std::function<void(const MessageView &)> &visitor) const override;
+  size_t for_each_first(
+      size_t n, time_t before,
+      const std::function<void(const MessageView &)> &visitor) const override;
+  [[nodiscard]] shared_ptr<const MessageSource> drop_first(
+      size_t n) const override;
+  bool save(SnapshotWriter &w) const override;
+
+ private:
+  shared_ptr<const Snapshot> snapshot_;
+  std::span<const BlockRecord> blocks_;
+  size_t skip_{}; /*!< The amount of messages of the first block that were
+                     dropped, which are never read. */
+  size_t size_{}; /*!< The amount of messages in the blocks, but skip_. */
+
+  /*! Reads the messages of some blocks but the first skip ones. */
+  void for_each_in(
+      std::span<const BlockRecord> blocks, size_t skip,
+      const std::function<void(const MessageView &)> &visitor) const;
+};
+
 struct ChannelDetails {
-  string name;
-  string type;
-  vector<Message> messages;
+  ChannelDetails() = default;
+  explicit ChannelDetails(DetailsAllocator a) : name{a}, type{a} {}
+
+  std::pmr::string name;
+  std::pmr::string type;
+  vector<Message> messages; /*!< Used by voice channels only. */
+  shared_ptr<const MessageSource> source; /*!< The messages not read yet. */
+  size_t archived{}; /*!< Used by text channels only. */
 };
 
 /*! A base class that represents a channel from a Concordo's server.
@@ -81,9 +464,9 @@ class Channel {
    *  @see server::Server::channels_
    */
   Channel() = default;
-  Channel(const Channel &) = default;
+  Channel(const Channel &) = delete;
   Channel(Channel &&) = delete;
-  Channel &operator=(const Channel &) = default;
+  Channel &operator=(const Channel &) = delete;
   Channel &operator=(Channel &&) = delete;
   virtual ~Channel() = default;
   /*! A constructor to be used by the system.
@@ -96,14 +479,26 @@ class Channel {
     return this->name_ == name;
   }
 
-  virtual void send_message(const Message &m) = 0;
+  /*! Sends a message, copying its content into the channel, which is the
+   *  only copy of it that is made.
+   */
+  virtual void send_message(const MessageView &m) = 0;
 
-  void print() { cout << name_ << '\n'; }
+  void print(ostream &out) const { out << name_ << '\n'; }
 
   virtual void save(fstream &f) = 0;
+  virtual void save(SnapshotWriter &w) const = 0;
+
+  /*! The lock of the messages of the channel.
+   *
+   *  Sending a message takes it exclusively, while listing and searching
+   *  share it, so every channel is changed independently of the others.
+   */
+  [[nodiscard]] std::shared_mutex &mutex() const { return mutex_; }
 
  private:
   string name_; /*!< The name of the channel. */
+  mutable std::shared_mutex mutex_; /*!< @see mutex() */
 };
 
 /*! A derived class that represents a text channel from a server.
@@ -123,19 +518,117 @@ class TextChannel : public Channel {
    */
   explicit TextChannel(string_view name) : Channel(name) {}
 
-  explicit TextChannel(const ChannelDetails &d)
-      : Channel(d.name), messages_{d.messages} {}
+  /*! A constructor to be used when loading, which takes the stored
+   *  messages over from the details.
+   */
+  explicit TextChannel(ChannelDetails &&d)
+      : Channel(d.name),
+        source_{std::move(d.source)},
+        archived_{d.archived} {}
 
   /*! @see messages_ */
-  vector<Message> getMessages() { return messages_; }
-  void send_message(const Message &m) override { messages_.push_back(m); }
-  [[nodiscard]] bool empty() const { return messages_.empty(); }
+  const MessageLog &getMessages() const {
+    load_messages();
+    return messages_;
+  }
+
+  /*! Selects a range of the messages, in the order they were sent, reading
+   *  the stored ones it needs.
+   *  @see MessageLog::select(); load_range()
+   */
+  [[nodiscard]] MessageLog::Slice select(const MessageRange &r) const;
+
+  /*! Searches the messages with the index.
+   *  @return The positions of the messages found, in the order they were sent
+   *  @see SearchQuery; index_
+   */
+  [[nodiscard]] vector<size_t> search(const SearchQuery &q) const;
+
+  /*! Sends a message to the channel, without reading the stored ones.
+   *  @see messages_; index_
+   */
+  void send_message(const MessageView &m) override;
+
+  /*! @return The amount of messages, including the ones not read yet */
+  [[nodiscard]] size_t size() const {
+    return messages_.size() + (source_ ? source_->size() : 0);
+  }
+  [[nodiscard]] bool empty() const { return size() == 0; }
+
+  /*! Reads the stored messages into memory, if they weren't yet.
+   *  @see source_
+   */
+  void load_messages() const;
+
+  /*! @return If every stored message was read into memory */
+  [[nodiscard]] bool loaded() const { return !source_; }
+
+  /*! @return If the messages read into memory include the whole range */
+  [[nodiscard]] bool covers(const MessageRange &r) const;
+
+  /*! Reads the last stored messages into memory, until they include the
+   *  whole range, so the older ones are left stored.
+   *  @see covers(); MessageSource::for_each_last()
+   */
+  void load_range(const MessageRange &r) const;
+
+  /*! @see retention_ */
+  [[nodiscard]] const std::optional<RetentionPolicy> &retention() const {
+    return retention_;
+  }
+
+  /*! @see retention_ */
+  void set_retention(const std::optional<RetentionPolicy> &p) {
+    retention_ = p;
+  }
+
+  /*! @see archived_ */
+  [[nodiscard]] size_t archived() const { return archived_; }
+
+  /*! Reads the oldest messages a policy doesn't keep, in order, passing each
+   *  one to the visitor. The stored messages kept aren't read.
+   *  @param now the date the ages are measured from
+   *  @param min the amount of the oldest messages read even if they're kept
+   *  @return The amount of messages read
+   *  @see RetentionPolicy; MessageSource::for_each_first(); archive_oldest()
+   */
+  size_t for_each_expired(
+      const RetentionPolicy &p, time_t now, size_t min,
+      const std::function<void(const MessageView &)> &visitor) const;
+
+  /*! Removes the oldest messages, which were moved to the archive, counting
+   *  them. The stored ones are dropped without being read.
+   *  @see for_each_expired(); archived_; MessageSource::drop_first()
+   */
+  void archive_oldest(size_t n);
 
   void save(fstream &f) override;
+  void save(SnapshotWriter &w) const override;
   void save_messages(fstream &f);
 
  private:
-  vector<Message> messages_; /*!< The list of all messages sent to a channel. */
+  mutable MessageLog
+      messages_; /*!< The log of all messages sent to a channel. */
+  mutable shared_ptr<const MessageSource>
+      source_; /*!< The stored messages that weren't read yet, which come
+                  before messages_. */
+  mutable InvertedIndex index_; /*!< The index of the words in messages_. It's
+                                   built when the messages are read. */
+  std::optional<RetentionPolicy>
+      retention_; /*!< The policy of the channel, which replaces the one of
+                     its server, if any. */
+  size_t archived_{}; /*!< The amount of messages ever moved to the archive,
+                         which is saved with the messages, so a save that
+                         fails after they're archived doesn't archive them
+                         twice. @see concordo::Archive::archived() */
+
+  /*! Joins the stored messages read to messages_, which come after them,
+   *  building the index if every stored message was read.
+   */
+  void prepend(MessageLog &&log) const;
+
+  /*! Builds the index of every message in messages_ again. */
+  void build_index() const;
 };
 
 /*! A derived class that represents a voice channel from a server.
@@ -154,22 +647,30 @@ class VoiceChannel : public Channel {
    *  @see Channel::Channel(string_view)
    */
   explicit VoiceChannel(string_view name) : Channel(name) {}
-  explicit VoiceChannel(const ChannelDetails &d)
-      : Channel(d.name), last_message_{d.messages[0]} {}
+  /*! A constructor to be used when loading, which takes the last message
+   *  over from the details, if it has one. The channels created by the
+   *  journal don't.
+   */
+  explicit VoiceChannel(ChannelDetails &&d) : Channel(d.name) {
+    if (!d.messages.empty()) {
+      last_message_ = std::move(d.messages.front());
+    }
+  }
 
   /*! @see last_message_ */
-  Message getMessage() { return last_message_; }
-  void send_message(const Message &m) override { last_message_ = m; }
+  [[nodiscard]] const Message &getMessage() const { return last_message_; }
+  void send_message(const MessageView &m) override {
+    last_message_ = Message{m};
+  }
   [[nodiscard]] bool empty() const { return last_message_.empty(); }
 
   void save(fstream &f) override;
+  void save(SnapshotWriter &w) const override;
 
  private:
   Message last_message_; /*!< The last "voice" message sent in the channel. */
 };
 
-string time_to_string(const time_t &t);
-
 }  // namespace concordo
 
 #endif  // CHANNELS_H
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace concordo {
+
+using std::string, std::string_view;
+
+/*! Compresses a buffer with a byte-oriented LZ77 codec, which writes the
+ *  block format of LZ4: sequences of literals, each one followed by a copy of
+ *  at least 4 bytes from up to 64 KiB back.
+ *
+ *  It favors speed over ratio, as the blocks are decompressed whenever the
+ *  messages in them are read.
+ *  @return The compressed buffer
+ *  @see decompress()
+ */
+string compress(string_view raw);
+
+/*! Decompresses a buffer written by compress(), checking every length and
+ *  offset against the buffers, so a corrupted one is never read past.
+ *  @param raw_size the size of the buffer before it was compressed
+ *  @param out where the buffer is decompressed, replacing its contents
+ *  @return False if the buffer is corrupted
+ */
+bool decompress(string_view compressed, size_t raw_size, string& out);
+
+}  // namespace concordo
+
+#endif  // COMPRESSION_H
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef FILES_H
+#define FILES_H
+
+#include <string>
+#include <string_view>
+
+namespace concordo {
+
+using std::string, std::string_view;
+
+/*! Syncs the contents of a file to the disk.
+ *  @return False if it couldn't be synced
+ */
+bool sync_file(const string& path);
+
+/*! Replaces a file with another one, so that a crash at any point leaves
+ *  either the whole old file or the whole new one.
+ *
+ *  The contents of the new file are synced to the disk before it's renamed
+ *  over the old one, and the directory is synced after, so the rename itself
+ *  survives a crash too.
+ *  @param from the new file, usually written aside as a temporary file
+ *  @param to the file that is replaced
+ *  @return False if it couldn't be replaced, in which case it's left as it was
+ */
+bool replace_file(const string& from, const string& to);
+
+/*! Appends data to the end of a file, creating it if needed, and syncs it to
+ *  the disk.
+ *
+ *  If the data can't be written whole, the file is cut back to its previous
+ *  size, so it never ends with part of the data.
+ *  @return False if it couldn't be appended
+ */
+bool append_file(const string& path, string_view data);
+
+}  // namespace concordo
+
+#endif  // FILES_H
@@ -0,0 +1,39 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef INDEXES_H
+#define INDEXES_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace concordo {
+
+using std::string, std::string_view, std::unordered_map;
+
+/*! A transparent hash for strings.
+ *
+ *  Allows looking up string keyed maps with a string_view without having to
+ *  build a temporary string.
+ *  @see StringMap
+ */
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(string_view sv) const {
+    return std::hash<string_view>{}(sv);
+  }
+};
+
+/*! A hash map indexed by names, which can be looked up by string_view.
+ *  @see StringHash
+ */
+template <typename T>
+using StringMap = unordered_map<string, T, StringHash, std::equal_to<>>;
+
+}  // namespace concordo
+
+#endif  // INDEXES_H
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <semaphore>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace concordo {
+
+using std::string, std::string_view, std::fstream;
+
+/*! A class that represents the append-only change journal of the system.
+ *
+ *  Every command that changes the system data appends a single record (one
+ *  line) to the journal instead of rewriting the snapshot files. From time to
+ *  time the journal is compacted into the snapshot and truncated.
+ *
+ *  By default every record is written before the command that appended it
+ *  finishes. With an asynchronous flush policy, the records are queued
+ *  instead, and a writer thread writes and syncs them to the disk in groups,
+ *  so the commands don't wait for the disk.
+ *
+ *  Every record is numbered, in the order it's written, so the ones already
+ *  compacted into the snapshot are skipped when it's replayed, even if the
+ *  journal couldn't be discarded after they were.
+ *  @see concordo::System::compact(); concordo::System::replay_journal()
+ */
+class Journal {
+ public:
+  /*! When the queued records are written and synced to the disk.
+   *
+   *  They're also written when the journal is destroyed and when sync() is
+   *  called. Without any limit, every record is written as it's appended.
+   */
+  struct FlushPolicy {
+    size_t records{0}; /*!< The amount of queued records that is written, or
+                          0 for any amount. */
+    std::chrono::milliseconds interval{0}; /*!< How long the oldest queued
+                                              record waits, or 0 for forever. */
+
+    [[nodiscard]] bool asynchronous() const {
+      return records > 0 || interval.count() > 0;
+    }
+  };
+
+  /*! A constructor to be used by the system.
+   *  @param filename the path of the journal file
+   */
+  explicit Journal(string_view filename)
+      : filename_{filename}, rotated_filename_{filename_ + ".old"} {}
+  Journal(const Journal&) = delete;
+  Journal(Journal&&) = delete;
+  Journal& operator=(const Journal&) = delete;
+  Journal& operator=(Journal&&) = delete;
+
+  /*! Writes the records still queued, if any. */
+  ~Journal();
+
+  /*! Sets when the records are written, starting the writer thread if the
+   *  policy is asynchronous.
+   *
+   *  To be called before any record is appended.
+   *  @see FlushPolicy
+   */
+  void set_policy(const FlushPolicy& p);
+
+  /*! Appends a record to the end of the journal.
+   *
+   *  It can be called by many threads at once, as the records are appended
+   *  one at a time. With an asynchronous policy it only queues the record,
+   *  which never waits for a lock.
+   *  @param record a single line describing a change, without the newline
+   */
+  void append(string_view record);
+
+  /*! Waits for every record appended so far to be synced to the disk.
+   *  @return False if any of them couldn't be written
+   */
+  bool sync();
+
+  /*! Calls the visitor with every record stored in the journal after a
+   *  number, in order, starting with the rotated ones.
+   *
+   *  The records stored twice are only visited once, and the ones written
+   *  before the records were numbered are always visited. The records
+   *  appended from now on are numbered after the last one stored.
+   *  @param after the number of the last record already applied
+   *  @return The amount of records read
+   */
+  size_t replay(uint64_t after,
+                const std::function<void(string_view)>& visitor);
+
+  /*! Discards every record of the journal.
+   *
+   *  To be used after its contents were compacted into the snapshot.
+   */
+  void clear();
+
+  /*! Sets the records of the journal aside, so the ones appended from now on
+   *  can be kept while they're being compacted.
+   *
+   *  The records are still replayed until they're discarded, and are joined
+   *  to the ones already set aside, if they weren't discarded yet.
+   *  @return False if they couldn't be set aside, in which case they're still
+   *  in the journal
+   *  @see discard_rotated()
+   */
+  bool rotate();
+
+  /*! Discards the records set aside, once their compaction is durable.
+   *  @see rotate()
+   */
+  void discard_rotated();
+
+  /*! @see records_ */
+  [[nodiscard]] size_t size() const { return records_; }
+
+  /*! @return The number of the last record appended, or replayed if none was
+   *  @see base_
+   */
+  [[nodiscard]] uint64_t sequence() const {
+    return base_ + queued_.load(std::memory_order_acquire);
+  }
+
+ private:
+  /*! A record in the queue, which links to the one queued before it. */
+  struct Node {
+    string record;
+    Node* next{nullptr};
+  };
+
+  string filename_;         /*!< The path of the journal file. */
+  string rotated_filename_; /*!< Where the records are set aside. */
+  int fd_{-1}; /*!< The journal file, lazily opened for appending. */
+  std::atomic<size_t>
+      records_{}; /*!< The amount of records since the last compaction. */
+  uint64_t base_{}; /*!< The number of the last record replayed, after which
+                       the ones appended are numbered. */
+  std::mutex mutex_; /*!< The lock of the writes to fd_. */
+  FlushPolicy policy_;
+  std::atomic<Node*> queue_{
+      nullptr}; /*!< The records not taken by the writer, newest first. */
+  std::atomic<uint64_t> queued_{}; /*!< The amount of records ever appended. */
+  std::atomic<uint64_t> synced_{}; /*!< The amount of them synced. */
+  std::atomic<uint64_t> sync_target_{}; /*!< The amount of records the
+                                           syncs wait for to be synced. */
+  std::atomic<bool> failed_{false}; /*!< If a write failed. */
+  std::counting_semaphore<> wake_{0}; /*!< Wakes up the writer. */
+  std::jthread writer_;
+
+  bool open();
+
+  /*! Writes some records to the file, opening it if needed. */
+  bool write(string_view records);
+
+  /*! Takes the queued records and writes them as the policy says, until the
+   *  thread is stopped.
+   *  @see policy_; queue_
+   */
+  void write_queued(const std::stop_token& stop);
+};
+
+}  // namespace concordo
+
+#endif  // JOURNAL_H
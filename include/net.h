@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef NET_H
+#define NET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "system.h"
+
+namespace concordo {
+
+using std::string, std::unique_ptr, std::unordered_map, std::vector;
+
+/*! A class that serves the system to many clients through a local socket.
+ *
+ *  Every connection is a session of the system, which sends commands as lines
+ *  and receives their output. The connections are multiplexed by an epoll
+ *  event loop in a single thread, so the commands run one at a time, in the
+ *  order they arrive.
+ *
+ *  The messages sent to the channel a client is visualizing are pushed to it
+ *  too. They are queued up to a limit, after which they are dropped, and the
+ *  queues are sent once per iteration of the loop.
+ *  @see System::Session; System::run(System::Session&, const CommandLine&)
+ */
+class Listener {
+ public:
+  explicit Listener(System& sys);
+  Listener(const Listener&) = delete;
+  Listener(Listener&&) = delete;
+  Listener& operator=(const Listener&) = delete;
+  Listener& operator=(Listener&&) = delete;
+  ~Listener();
+
+  /*! Listens on a TCP port of the loopback interface.
+   *  @param port the port, or 0 to let the OS choose one
+   *  @return True if the socket is listening
+   *  @see port()
+   */
+  bool listen_tcp(uint16_t port);
+
+  /*! Listens on a Unix socket, replacing the file if it already exists.
+   *  @return True if the socket is listening
+   */
+  bool listen_unix(const string& path);
+
+  /*! @return The TCP port being listened on, or 0 if there is none */
+  [[nodiscard]] uint16_t port() const;
+
+  /*! Serves the clients until the process receives SIGINT or SIGTERM.
+   *  @return False if the event loop couldn't be started
+   */
+  bool run();
+
+ private:
+  struct Connection;
+
+  System& sys_;
+  int listen_fd_{-1};
+  int epoll_fd_{-1};
+  int signal_fd_{-1};
+  string unix_path_; /*!< The Unix socket file, removed when done. */
+  unordered_map<int, unique_ptr<Connection>>
+      connections_; /*!< The open connections, by file descriptor. */
+  vector<int> pushed_; /*!< The connections that were pushed messages. */
+
+  static constexpr size_t kMaxLine{
+      65536}; /*!< The longest line a client may send. */
+  static constexpr size_t kMaxPendingOutput{
+      1 << 20}; /*!< The output that stops a client's commands from being
+                   read until it's sent. */
+  static constexpr size_t kMaxPushedOutput{
+      1 << 18}; /*!< The output from which pushed messages are dropped. */
+
+  void accept_all();
+  void receive(Connection& c);
+
+  /*! Runs the complete lines received, while there is room for the output.
+   */
+  void process(Connection& c);
+
+  /*! Sends as much of the pending output as the socket takes. */
+  void flush(Connection& c);
+
+  /*! Watches the socket for the events the connection is ready for. */
+  void update_events(Connection& c);
+
+  /*! Sends the messages pushed to the connections since the last time. */
+  void flush_pushed();
+
+  void close(int fd);
+};
+
+}  // namespace concordo
+
+#endif  // NET_H
@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace concordo {
+
+using std::string, std::string_view, std::vector, std::span;
+
+/*! A struct that contains a search for messages.
+ *
+ *  A message matches the search if it contains every term, was sent by the
+ *  sender (if any), and was sent in [after, before). A term ending with '*'
+ *  matches every word starting with the rest of it.
+ *  @see concordo::System::search_messages()
+ */
+struct SearchQuery {
+  vector<string> terms; /*!< The terms, already split into words. */
+  std::optional<int> sender_id;
+  time_t after{std::numeric_limits<time_t>::min()};
+  time_t before{std::numeric_limits<time_t>::max()};
+};
+
+/*! A class that indexes the messages of a channel by the words in them.
+ *
+ *  Every word maps to the sorted positions of the messages that contain it,
+ *  and the words are kept sorted so prefixes can be looked up too.
+ *  @see TextChannel::index_
+ */
+class InvertedIndex {
+ public:
+  /*! Indexes the words of a message.
+   *
+   *  The positions have to be added in increasing order.
+   */
+  void add(size_t position, string_view content);
+
+  void clear() { postings_.clear(); }
+
+  /*! Finds the messages that contain every term.
+   *  @return The sorted positions of said messages
+   */
+  [[nodiscard]] vector<size_t> search(const vector<string>& terms) const;
+
+ private:
+  std::map<string, vector<size_t>, std::less<>>
+      postings_; /*!< The positions of the messages containing each word. */
+
+  /*! Finds the messages that contain a term.
+   *  @param scratch the storage for the merged postings of a prefix
+   *  @return The sorted positions of said messages
+   */
+  [[nodiscard]] span<const size_t> lookup(
+      string_view term, vector<vector<size_t>>& scratch) const;
+};
+
+// Split a text into lowercase words, passing each one to the visitor.
+void for_each_word(string_view text,
+                   const std::function<void(string_view)>& visitor);
+
+}  // namespace concordo
+
+#endif  // SEARCH_H
@@ -6,25 +6,36 @@
 #define SERVERS_H
 
 #include <algorithm>
+#include <atomic>
 #include <concepts>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <typeinfo>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "channels.h"
+#include "indexes.h"
+#include "slot_map.h"
 #include "users.h"
 
 namespace concordo {
 
-using std::unique_ptr, std::string, std::string_view, std::vector, std::cout,
-    std::fstream;
+using std::unique_ptr, std::string, std::string_view, std::vector, std::ostream,
+    std::fstream, std::unordered_set;
 namespace ranges = std::ranges;
 
+/*! A handle to a channel of a server.
+ *  @see Server::find_channel(); Server::get_channel()
+ */
+using ChannelHandle = SlotHandle<unique_ptr<Channel>>;
+
 /*! A struct that contains server details.
  *
  *  The server details are used as input for some system commands.
@@ -33,11 +44,17 @@ namespace ranges = std::ranges;
  *  concordo::System::change_invite(); concordo::System::enter_server()
  */
 struct ServerDetails {
-  int owner_id;
-  string name;        /*!< A server name to be input from the system. */
-  string description; /*!< A server description to be input from the system. */
-  string invite_code; /*!< A server invite code to be input from the system. */
-  vector<int> members_ids;
+  ServerDetails() = default;
+  explicit ServerDetails(DetailsAllocator a)
+      : name{a}, description{a}, invite_code{a}, members_ids{a} {}
+
+  int owner_id{};
+  std::pmr::string name; /*!< A server name to be input from the system. */
+  std::pmr::string description; /*!< A server description to be input from
+                                   the system. */
+  std::pmr::string invite_code; /*!< A server invite code to be input from
+                                   the system. */
+  std::pmr::vector<int> members_ids;
 };
 
 /*! A class that represents a server in the Concordo system.
@@ -49,7 +66,7 @@ struct ServerDetails {
 class Server {
  public:
   /*! Default constructor to be used by std::vector class.
-   *  @see concordo::System::servers_list_
+   *  @see concordo::System::servers_
    */
   Server() = default;
 
@@ -62,26 +79,78 @@ class Server {
         name_{d.name},
         description_{d.description},
         invite_code_{d.invite_code},
-        members_ids_{d.members_ids} {}
+        members_ids_(d.members_ids.begin(), d.members_ids.end()),
+        members_set_(d.members_ids.begin(), d.members_ids.end()),
+        dirty_{false} {}
 
   [[nodiscard]] string getName() const { return name_; }
 
   [[nodiscard]] vector<int> getMembers() const { return members_ids_; }
 
-  constexpr vector<unique_ptr<Channel>>& getChannels() { return channels_; }
+  /*! @return A view of the channels, in the order they were created */
+  [[nodiscard]] auto getChannels() const { return channels_.values(); }
 
-  void change_description(string_view desc) { this->description_ = desc; }
-  void change_invite(string_view code) { this->invite_code_ = code; }
+  void change_description(string_view desc) {
+    this->description_ = desc;
+    mark_dirty();
+  }
+  void change_invite(string_view code) {
+    this->invite_code_ = code;
+    mark_dirty();
+  }
 
   /*! A method that adds an user to the member list.
    *  @see members_ids_
    */
-  void add_member(const User& u) { members_ids_.push_back(u.getId()); }
-  void create_channel(unique_ptr<Channel> c) {
-    channels_.push_back(std::move(c));
+  void add_member(const User& u) {
+    members_ids_.push_back(u.getId());
+    members_set_.insert(u.getId());
+    mark_dirty();
+  }
+
+  /*! A method that adds a channel to the channel list, indexing it by name.
+   *  @see channels_; text_channels_; voice_channels_
+   */
+  void create_channel(unique_ptr<Channel> c);
+
+  /*! Marks the server as changed since it was saved, which the messages sent
+   *  to its channels do too.
+   *  @see dirty_
+   */
+  void mark_dirty() { dirty_ = true; }
+
+  /*! @return If the server changed since the last call
+   *  @see dirty_
+   */
+  bool take_dirty() { return dirty_.exchange(false); }
+
+  /*! @see retention_ */
+  [[nodiscard]] const RetentionPolicy& retention() const { return retention_; }
+
+  /*! @see retention_ */
+  void set_retention(const RetentionPolicy& p) { retention_ = p; }
+
+  /*! @see shard_ */
+  [[nodiscard]] int shard() const { return shard_; }
+
+  /*! @see shard_ */
+  void set_shard(int s) { shard_ = s; }
+
+  /*! @see file_ */
+  void set_file(const shared_ptr<MessageFile>& f) { file_ = f; }
+
+  /*! Pins the file the server was loaded from, if its channels still read
+   *  messages from it, before it's replaced.
+   *  @return False if it couldn't be opened
+   *  @see MessageFile::pin()
+   */
+  bool pin_file() {
+    const auto f{file_.lock()};
+    return !f || f->pin();
   }
 
   void save(fstream& f);
+  void save(SnapshotWriter& w) const;
   void save_owner(fstream& f) const { f << owner_id_ << '\n'; }
   void save_description(fstream& f) { f << description_ << '\n'; }
   void save_invite(fstream& f) { f << invite_code_ << '\n'; }
@@ -98,31 +167,52 @@ class Server {
     return u.check_id(owner_id_);
   }
 
-  [[nodiscard]] bool check_invite(const string& ic) const {
+  [[nodiscard]] bool check_invite(string_view ic) const {
     return invite_code_ == ic;
   }
 
   [[nodiscard]] bool check_member(const User& u) const {
-    return ranges::any_of(members_ids_, [&](int id) { return u.check_id(id); });
+    return members_set_.contains(u.getId());
   }
 
   [[nodiscard]] bool check_channel(const ChannelDetails& cd) const;
-  constexpr auto find_channel(string_view name);
 
-  void print() const { cout << name_ << '\n'; }
+  /*! Finds the first channel created with the input name.
+   *  @return The handle to the channel, or the null handle if there is none
+   */
+  [[nodiscard]] ChannelHandle find_channel(string_view name) const;
+
+  /*! Finds the channel with the input name and type ("text" or "voice").
+   *  @return The handle to the channel, or the null handle if there is none
+   */
+  [[nodiscard]] ChannelHandle find_channel(string_view name,
+                                           string_view type) const;
+
+  /*! @return The channel, or nullptr if the handle isn't valid */
+  [[nodiscard]] Channel* get_channel(ChannelHandle h) const {
+    const auto* c{channels_.get(h)};
+    return c != nullptr ? c->get() : nullptr;
+  }
+
+  void print(ostream& out) const { out << name_ << '\n'; }
 
   [[nodiscard]] bool has_invite() const { return !invite_code_.empty(); }
 
-  void list_text_channels() const;
+  void list_text_channels(ostream& out) const;
 
-  void list_voice_channels() const;
+  void list_voice_channels(ostream& out) const;
 
-  constexpr bool any_of(string_view name) {
-    namespace ranges = std::ranges;
-    return ranges::any_of(channels_,
-                          [=](const auto& c) { return c->check_name(name); });
+  [[nodiscard]] bool any_of(string_view name) const {
+    return text_channels_.contains(name) || voice_channels_.contains(name);
   }
 
+  /*! The lock of the server details, members and channel list.
+   *
+   *  The messages of its channels are locked by each channel instead.
+   *  @see Channel::mutex()
+   */
+  [[nodiscard]] std::shared_mutex& mutex() const { return mutex_; }
+
   friend ostream& operator<<(ostream& out, const Server& s);
 
  private:
@@ -130,10 +220,29 @@ class Server {
   string name_;    /*!< The name of the server. It's unique. */
   string description_; /*!< The description of the server. Can be changed. */
   string invite_code_; /*!< The invite code of the server. Can be empty. */
-  vector<unique_ptr<Channel>>
+  SlotMap<unique_ptr<Channel>>
       channels_;            /*!< The list of channels from the server. */
   vector<int> members_ids_; /*!< The list of ids from the users that are member
                                of the server */
+  unordered_set<int> members_set_; /*!< The ids of members_ids_, for lookup. */
+  StringMap<ChannelHandle> text_channels_; /*!< The handles of the text
+                                              channels, by name. */
+  StringMap<ChannelHandle> voice_channels_; /*!< The handles of the voice
+                                               channels, by name. */
+  mutable std::shared_mutex mutex_; /*!< @see mutex() */
+  std::atomic<bool> dirty_{true}; /*!< If it changed since it was saved, so
+                                     its file must be written again. */
+  int shard_{}; /*!< The number of its file in the sharded format, or 0 if
+                   it has none yet. */
+  std::weak_ptr<MessageFile> file_; /*!< The file it was loaded from, while
+                                       its channels read from it. */
+  RetentionPolicy retention_; /*!< The policy of its text channels that have
+                                 none of their own. */
+
+  [[nodiscard]] const StringMap<ChannelHandle>& channel_index(
+      string_view type) const {
+    return type == "text" ? text_channels_ : voice_channels_;
+  }
 };
 
 template <typename ChildType>
@@ -0,0 +1,135 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+namespace concordo {
+
+using std::deque, std::vector;
+
+/*! A handle to a value of a SlotMap.
+ *
+ *  It stays valid until the value is erased, and is told apart from the
+ *  handles to the values that reuse its slot by the generation.
+ *  @see SlotMap
+ */
+template <typename T>
+struct SlotHandle {
+  uint32_t index{};      /*!< The slot of the value. */
+  uint32_t generation{}; /*!< 0 for the null handle, which is never valid. */
+
+  bool operator==(const SlotHandle&) const = default;
+
+  explicit operator bool() const { return generation != 0; }
+};
+
+/*! A container of values referred to by generational handles.
+ *
+ *  The values never move, so pointers to them are valid while they aren't
+ *  erased, and a handle to an erased value is detected instead of dangling.
+ *  The values are iterated in the order they were inserted.
+ *  @see SlotHandle
+ */
+template <typename T>
+class SlotMap {
+ public:
+  using Handle = SlotHandle<T>;
+
+  /*! Inserts a value, reusing the slot of an erased one if there is any.
+   *  @return The handle to the value
+   */
+  template <typename... Args>
+  Handle emplace(Args&&... args) {
+    uint32_t index{};
+    if (free_.empty()) {
+      index = static_cast<uint32_t>(slots_.size());
+      slots_.emplace_back();
+    } else {
+      index = free_.back();
+      free_.pop_back();
+    }
+    Slot& s{slots_[index]};
+    s.value.emplace(std::forward<Args>(args)...);
+    ++s.generation;
+    order_.push_back(index);
+    return {index, s.generation};
+  }
+
+  /*! @return The value, or nullptr if the handle isn't valid anymore */
+  [[nodiscard]] T* get(Handle h) {
+    return contains(h) ? &*slots_[h.index].value : nullptr;
+  }
+
+  /*! @return The value, or nullptr if the handle isn't valid anymore */
+  [[nodiscard]] const T* get(Handle h) const {
+    return contains(h) ? &*slots_[h.index].value : nullptr;
+  }
+
+  [[nodiscard]] bool contains(Handle h) const {
+    return h.index < slots_.size() && slots_[h.index].value.has_value() &&
+           slots_[h.index].generation == h.generation;
+  }
+
+  /*! Erases a value, invalidating every handle to it.
+   *  @return False if the handle wasn't valid
+   */
+  bool erase(Handle h) {
+    if (!contains(h)) {
+      return false;
+    }
+    Slot& s{slots_[h.index]};
+    s.value.reset();
+    ++s.generation;
+    free_.push_back(h.index);
+    std::erase(order_, h.index);
+    return true;
+  }
+
+  /*! Erases every value, invalidating every handle. */
+  void clear() {
+    for (uint32_t i{0}; i < slots_.size(); ++i) {
+      if (slots_[i].value.has_value()) {
+        slots_[i].value.reset();
+        ++slots_[i].generation;
+        free_.push_back(i);
+      }
+    }
+    order_.clear();
+  }
+
+  [[nodiscard]] size_t size() const { return order_.size(); }
+
+  [[nodiscard]] bool empty() const { return order_.empty(); }
+
+  /*! @return A view of the values, in the order they were inserted */
+  [[nodiscard]] auto values() const {
+    return order_ | std::views::transform([this](uint32_t i) -> const T& {
+             return *slots_[i].value;
+           });
+  }
+
+ private:
+  struct Slot {
+    uint32_t generation{}; /*!< Incremented on every insertion and erasure. */
+    std::optional<T> value;
+  };
+
+  deque<Slot> slots_;      /*!< The slots, which never move. */
+  vector<uint32_t> free_;  /*!< The slots without a value. */
+  vector<uint32_t> order_; /*!< The slots with a value, by insertion. */
+};
+
+}  // namespace concordo
+
+#endif  // SLOT_MAP_H
@@ -0,0 +1,247 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace concordo {
+
+using std::string, std::string_view, std::vector, std::span;
+
+/*! A reference to a string stored in the string table of a snapshot.
+ *  @see SnapshotHeader::strings_offset
+ */
+struct StrRef {
+  uint32_t offset; /*!< The offset of the string in the string table. */
+  uint32_t length; /*!< The length of the string, in bytes. */
+};
+
+struct UserRecord {
+  int32_t id;
+  StrRef name;
+  StrRef address;
+  StrRef password;
+};
+
+struct ServerRecord {
+  int32_t owner_id;
+  StrRef name;
+  StrRef description;
+  StrRef invite_code;
+  uint32_t first_member;  /*!< The first member in the member table. */
+  uint32_t members_count; /*!< The amount of members of the server. */
+  uint32_t first_channel; /*!< The first channel in the channel table. */
+  uint32_t channels_count; /*!< The amount of channels of the server. */
+};
+
+struct ChannelRecord {
+  StrRef name;
+  StrRef type;             /*!< Either "text" or "voice". */
+  uint32_t first_message;  /*!< The first message in the message table. */
+  uint32_t messages_count; /*!< The amount of messages in the message table. */
+  uint32_t first_block;    /*!< The first block in the block table. */
+  uint32_t blocks_count;   /*!< The amount of blocks of compressed messages,
+                              which the channel has instead of messages in
+                              the message table. */
+  uint64_t archived; /*!< The amount of messages moved to the archive. Since
+                        version 3. */
+};
+
+struct MessageRecord {
+  int64_t date_time; /*!< The raw time_t of when the message was sent. */
+  int32_t sender_id;
+  StrRef content;
+};
+
+/*! A block of consecutive messages of a channel, compressed together.
+ *
+ *  Every message is stored in the block as its date (8 bytes), its sender
+ *  id and the length of its content (4 bytes each), and then its content.
+ *  @see compress(); Snapshot::for_each_message()
+ */
+struct BlockRecord {
+  StrRef data;             /*!< The compressed block, in the string table. */
+  uint32_t raw_size;       /*!< The size of the block before compressed. */
+  uint32_t messages_count; /*!< The amount of messages in the block. */
+  int64_t first_date; /*!< The raw time_t of its first message. The blocks
+                         of version 2 have the minimum instead. */
+};
+
+/*! The fixed-width header at the beginning of every snapshot file.
+ *
+ *  Every table is an array of records placed at the given offset from the
+ *  beginning of the file. Strings are not stored inside the records, but in a
+ *  single string table referenced by StrRef.
+ */
+struct SnapshotHeader {
+  char magic[8];  /*!< Always kSnapshotMagic. */
+  uint32_t version; /*!< kSnapshotVersion, or an older version read. */
+  int32_t last_id;  /*!< The last user id generated by the system. */
+  uint64_t users_offset;
+  uint64_t users_count;
+  uint64_t servers_offset;
+  uint64_t servers_count;
+  uint64_t members_offset;
+  uint64_t members_count;
+  uint64_t channels_offset;
+  uint64_t channels_count;
+  uint64_t messages_offset;
+  uint64_t messages_count;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t blocks_offset; /*!< Since version 2. */
+  uint64_t blocks_count;
+};
+
+inline constexpr string_view kSnapshotMagic{"CONCORDO", 8};
+inline constexpr uint32_t kSnapshotVersion{3};
+
+/*! A class that builds a binary snapshot of the system.
+ *
+ *  The objects are added in a tree order: every member and channel added
+ *  belongs to the last server added, and every message to the last channel.
+ *  @see Snapshot; concordo::System::save_snapshot()
+ */
+class SnapshotWriter {
+ public:
+  /*! The size a block of messages reaches before it's compressed. */
+  static constexpr size_t kBlockSize{16 * 1024};
+
+  /*! The largest offset or count the records hold, as they're 32 bits wide,
+   *  past which the snapshot can't be written.
+   *  @see StrRef
+   */
+  static constexpr size_t kMaxSize{std::numeric_limits<uint32_t>::max()};
+
+  SnapshotWriter() = default;
+
+  /*! @param compress if the messages of the text channels are compressed in
+   *  blocks
+   */
+  explicit SnapshotWriter(bool compress) : compress_{compress} {}
+
+  void add_user(int id, string_view name, string_view address,
+                string_view password);
+  void add_server(int owner_id, string_view name, string_view description,
+                  string_view invite_code);
+  void add_member(int id);
+  /*! @param archived the amount of messages moved to the archive */
+  void add_channel(string_view name, string_view type, size_t archived = 0);
+  void add_message(time_t date_time, int sender_id, string_view content);
+
+  /*! Adds a block of messages to the last channel as it's already
+   *  compressed, after the messages added to it so far.
+   *  @see compressing()
+   */
+  void add_block(const BlockRecord& b, string_view data);
+
+  /*! @return If the messages added to the last channel are compressed */
+  [[nodiscard]] bool compressing() const { return compressing_; }
+
+  /*! Makes write() fail, as something added couldn't be read whole. */
+  void fail() { failed_ = true; }
+
+  /*! Writes the snapshot to a file, truncating it.
+   *
+   *  The current snapshot may still be mapped, so the new one is meant to be
+   *  written aside and then replace it.
+   *  @return True if the whole snapshot was written, so it didn't fail() nor
+   *  grow past kMaxSize
+   *  @see replace_file()
+   */
+  bool write(const string& filename, int last_id);
+
+ private:
+  vector<UserRecord> users_;
+  vector<ServerRecord> servers_;
+  vector<int32_t> members_;
+  vector<ChannelRecord> channels_;
+  vector<MessageRecord> messages_;
+  vector<BlockRecord> blocks_;
+  string strings_; /*!< The string table. */
+  bool compress_{false};
+  bool compressing_{false}; /*!< If the last channel is compressed. */
+  bool failed_{false}; /*!< @see fail() */
+  string block_; /*!< The messages added, not compressed into a block yet. */
+  uint32_t block_messages_{}; /*!< The amount of messages in block_. */
+  time_t block_first_date_{}; /*!< The date of the first message in block_. */
+
+  StrRef add_string(string_view s);
+
+  /*! Compresses the messages added into a block, if there's any. */
+  void flush_block();
+};
+
+/*! A class that represents a binary snapshot mapped into memory.
+ *
+ *  Nothing is parsed when the snapshot is opened; the tables are read
+ *  directly from the mapping when the objects are materialized.
+ *  @see SnapshotWriter; concordo::System::load_snapshot()
+ */
+class Snapshot {
+ public:
+  Snapshot() = default;
+  Snapshot(const Snapshot&) = delete;
+  Snapshot(Snapshot&&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+  Snapshot& operator=(Snapshot&&) = delete;
+  ~Snapshot();
+
+  /*! Maps a snapshot file into memory and validates its header.
+   *  @return True if the file is a valid snapshot
+   */
+  bool open(const string& filename);
+
+  /*! @see header_ */
+  [[nodiscard]] const SnapshotHeader& header() const { return header_; }
+
+  [[nodiscard]] span<const UserRecord> users() const;
+  [[nodiscard]] span<const ServerRecord> servers() const;
+  [[nodiscard]] span<const int32_t> members(const ServerRecord& s) const;
+  [[nodiscard]] span<const ChannelRecord> channels(
+      const ServerRecord& s) const;
+  [[nodiscard]] span<const MessageRecord> messages(
+      const ChannelRecord& c) const;
+  [[nodiscard]] span<const BlockRecord> blocks(const ChannelRecord& c) const;
+  [[nodiscard]] string_view str(StrRef r) const;
+
+  /*! Decompresses a block and passes each of its messages to the visitor, in
+   *  order. A corrupted block is read up to where it's corrupted.
+   *  @see BlockRecord
+   */
+  void for_each_message(
+      const BlockRecord& b,
+      const std::function<void(time_t, int, string_view)>& visitor) const;
+
+ private:
+  void* data_{nullptr}; /*!< The beginning of the mapping. */
+  size_t size_{};       /*!< The size of the mapping, in bytes. */
+  SnapshotHeader header_{}; /*!< The header, whose fields missing in the
+                               older versions are zeroed. */
+  vector<ChannelRecord> channels_; /*!< The channel table of a snapshot of
+                                      an older version, converted, as its
+                                      records were smaller. */
+  vector<BlockRecord> blocks_; /*!< The block table of a snapshot of version
+                                  2, converted likewise. */
+
+  template <typename Record>
+  span<const Record> table(uint64_t offset, uint64_t first,
+                           uint64_t count) const;
+  [[nodiscard]] bool check_table(uint64_t offset, uint64_t count,
+                                 size_t record_size) const;
+};
+
+}  // namespace concordo
+
+#endif  // SNAPSHOT_H
@@ -6,41 +6,102 @@
 #define SYSTEM_H
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <concepts>
+#include <cstdint>
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <initializer_list>
+#include <iostream>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <memory_resource>
+#include <optional>
 #include <ranges>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
-#include <unordered_set>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include "archive.h"
 #include "channels.h"
+#include "indexes.h"
+#include "journal.h"
 #include "servers.h"
+#include "slot_map.h"
+#include "snapshot.h"
 #include "users.h"
 
 namespace concordo {
 
 using std::string, std::string_view, std::vector, std::tuple,
-    std::unordered_set, std::unique_ptr, std::fstream, std::pair;
+    std::unordered_map, std::unique_ptr, std::fstream,
+    std::pair, std::shared_ptr, std::ostream, std::deque;
 
 /*! A struct that contains a line input to the CLI.
  *  @see System; System::run()
  */
 struct CommandLine {
-  string command;   /*!< The command part of the line. */
-  string arguments; /*!< The argument part of the line. */
+  string_view command;   /*!< The command part of the line. */
+  string_view arguments; /*!< The argument part of the line. */
+};
+
+class System;
+
+/*! An interface for the clients that receive the messages sent to the channel
+ *  they are visualizing, as soon as they are sent.
+ *  @see System::Session::subscriber; Listener
+ */
+class Subscriber {
+ public:
+  Subscriber() = default;
+  Subscriber(const Subscriber&) = delete;
+  Subscriber(Subscriber&&) = delete;
+  Subscriber& operator=(const Subscriber&) = delete;
+  Subscriber& operator=(Subscriber&&) = delete;
+  virtual ~Subscriber() = default;
+
+  /*! Queues a message, already rendered, to be delivered.
+   *
+   *  It must not wait for the client, so the sender isn't slowed down.
+   *  @return False if the message was dropped, as the queue is full
+   */
+  virtual bool deliver(string_view message) = 0;
+};
+
+/*! A struct that describes a command of the CLI.
+ *  @see System::find_command(); System::run()
+ */
+struct CommandSpec {
+  string_view name;
+  void (*handler)(System& sys, string_view args); /*!< Runs the command. */
+  unsigned states; /*!< The mask of the states the command is allowed in. */
+  bool persists;   /*!< If the command changes the stored data. */
+  bool exclusive;  /*!< If no other command may run at the same time. */
 };
 
 /*! A class that represents Concordo's system.
  *
  *  The system is responsible for managing Users, Channels, Servers, and
  *  interacting with the CLI.
+ *
+ *  Many threads may run the commands of their sessions at once. The user
+ *  list, the server list, every server and every channel have their own
+ *  locks, which are taken in that order (servers before a server, a server
+ *  before its channels, and the users and the journal last), so sessions
+ *  visualizing different channels don't wait for each other, and readers
+ *  only wait for the writers of what they read. The commands that save or
+ *  replace the whole system take state_mutex_ exclusively, while the others
+ *  share it.
  *  @see user::User; channel::Channel; server::Server
  */
 class System {
@@ -58,40 +119,117 @@ class System {
                       server. */
   };
 
+  /*! Represents the formats in which the system data can be stored. */
+  enum class StorageFormat {
+    kText,   /*!< Line-oriented users.txt and servers.txt files. */
+    kBinary, /*!< A single memory-mapped binary snapshot file. */
+    kSharded /*!< users.txt, a file per server in servers/ and manifest.txt,
+                which lists them. Only the servers changed are saved. */
+  };
+
+  using UserHandle = SlotMap<User>::Handle;
+  using ServerHandle = SlotMap<shared_ptr<Server>>::Handle;
+
+  /*! A struct that contains the state of a batch of commands, which belongs
+   *  to the session that started it.
+   *  @see begin_batch(); commit_batch()
+   */
+  struct Batch {
+    bool started{false}; /*!< If the commands are being run in a batch. */
+    bool changed{false}; /*!< If the batch changed the system. */
+    size_t commands{};   /*!< The amount of commands run in the batch. */
+    std::chrono::steady_clock::time_point start; /*!< When it started. */
+  };
+
+  /*! A struct that contains the state of a user session.
+   *
+   *  Every client of a Concordo server has its own session, which is attached
+   *  to the system while one of its commands runs. The user, server and
+   *  channel are kept as handles, which are resolved without looking them up
+   *  again, and tell when what they refer to was removed or reloaded.
+   *  @see run(Session&, const CommandLine&); Listener
+   */
+  struct Session {
+    SystemState state{SystemState::kGuest};
+    UserHandle user;       /*!< The logged-in user. */
+    ServerHandle server;   /*!< The server being visualized. */
+    ChannelHandle channel; /*!< The channel being visualized. */
+    ostream* output{&std::cout}; /*!< Where the output of the commands goes. */
+    Subscriber* subscriber{nullptr}; /*!< Who receives the new messages of the
+                                        channel, if anyone. */
+    const Channel* subscribed{nullptr}; /*!< The channel subscribed to. */
+    Batch batch; /*!< The batch of the session, if it started one. */
+  };
+
+  /*! @see format_ */
+  void set_format(StorageFormat f) { format_ = f; }
+
+  /*! @see background_saves_ */
+  void set_background_saves(bool b) { background_saves_ = b; }
+
+  /*! @see load_threads_ */
+  void set_load_threads(size_t n) { load_threads_ = n; }
+
+  /*! @see compress_ */
+  void set_compression(bool b) { compress_ = b; }
+
+  /*! Sets when the journal is written, which can make the commands not wait
+   *  for the disk.
+   *
+   *  To be called before the system is started.
+   *  @see Journal::FlushPolicy; sync()
+   */
+  void set_flush_policy(const Journal::FlushPolicy& p) {
+    journal_.set_policy(p);
+  }
+
   /*! Starts the main Concordo loop. */
   void init();
 
+  /*! Loads the stored data, including the journal.
+   *  @see load(); replay_journal()
+   */
+  void start();
+
+  /*! Saves every pending change, committing the batch if there is one, and
+   *  waits for it to be durable.
+   *  @see commit_batch(); compact()
+   */
+  void finish();
+
   /*! Runs the command input in the CLI.
    *
    *  This method respects the current system state to determine what the user
    *  is allowed to do.
-   *  @see SystemState; current_state_
+   *  @see SystemState; console_
    */
   void run(const CommandLine& cl);
 
-  /*! Runs the commands allowed to a guest.
-   *  @see SystemState; current_state_; guest_commands_
-   */
-  void run_guest_cmd(const CommandLine& cl);
-
-  /*! Runs the commands allowed to a logged-in user.
-   *  @see SystemState; current_state_; logged_commands_
+  /*! Runs a command input by a session, which is attached to the system
+   *  while it runs.
+   *
+   *  If the user, server or channel of the session doesn't exist anymore,
+   *  it goes back to the previous state. Sessions can be run by
+   *  different threads at once, but each session by a thread at a time.
+   *  @see Session; attach(); detach()
    */
-  void run_logged_cmd(const CommandLine& cl);
+  void run(Session& s, const CommandLine& cl);
 
-  /*! Runs the commands allowed to an user visualizing a server.
-   *  @see SystemState; current_state_; server_commands_
+  /*! Stops delivering messages to a session that is ending, and commits its
+   *  batch, if it started one.
+   *  @see Session::subscriber; Session::batch
    */
-  void run_server_cmd(const CommandLine& cl);
-
-  void run_channel_cmd(const CommandLine& cl);
+  void close_session(Session& s);
 
-  /*! Checks if the input command is a valid command.
-   *  @param cmd the command to be checked
-   *  @return True if the command is valid.
-   *  @see guest_commands_; logged_commands_; server_commands_
+  /*! Finds a command of the CLI by its name.
+   *
+   *  The commands are kept in a table built at compile time, which is
+   *  indexed by a perfect hash of their names.
+   *  @param name the name of the command
+   *  @return The command, or nullptr if there is no such command
+   *  @see Command
    */
-  bool check_all_commands(string_view cmd) const;
+  static const CommandSpec* find_command(string_view name);
 
   /*! Checks if the input credentials are valid.
    *
@@ -103,81 +241,98 @@ class System {
    */
   [[nodiscard]] bool check_credentials(string_view cred) const;
 
-  /*! Find the position of an user in the system.
+  /*! Find an user in the system.
    *
-   *  Goes through the entire user list checking if an user has the same id
-   *  as the input one, giving the position of it when it is found. It expects
-   *  that the user being looked for exists.
+   *  Looks up the id index for an user with the same id as the input one.
    *  @param id the id to be checked
-   *  @see users_list_
+   *  @see users_; users_by_id_
    *  @see user::User; user::User::id_
-   *  @return An iterator pointing to the position of the user in the user list
+   *  @return A pointer to the user, which stays valid as the users are never
+   *  removed, or nullptr if there is no such user
    */
-  [[nodiscard]] auto find_user(int id) const;
+  [[nodiscard]] const User* find_user(int id) const;
 
-  /*! Find the position of an user in the system.
+  /*! Find an user in the system.
    *
-   *  Goes through the entire user list checking if an user has the same
-   *  address as the input one, giving the position of it when it is found. It
-   *  expects that the user being looked for exists.
+   *  Looks up the address index for an user with the same address as the
+   *  input one.
    *  @param address the address to be checked
-   *  @see users_list_;
+   *  @see users_; users_by_address_
    *  @see user::User; user::User::address_
-   *  @return An iterator pointing to the position of the user in the user list
+   *  @return A pointer to the user, or nullptr if there is no such user
    */
-  [[nodiscard]] auto find_user(string_view address);
+  [[nodiscard]] User* find_user(string_view address);
 
   /*! Gets the name of the user with the same id and the input one.
-   *
-   *  This method expects that the input id is valid.
    *  @param id the id to be checked
-   *  @see find_user(); users_list_
+   *  @see user_names_
    *  @see user::User; user::User::id_; user::User::name_
-   *  @return The name of said user
+   *  The name stays valid after users_mutex_ is released, until the system is
+   *  replaced by a load (see user_names_).
+   *  @return The name of said user, or an empty name if there is none
    */
-  [[nodiscard]] string get_user_name(int id) const;
+  [[nodiscard]] string_view get_user_name(int id) const;
 
   /*! Creates an user in the system.
    *  @param args the arguments of the create-user command.
-   *  @see users_list_; last_id_
+   *  @see users_; last_id_
    *  @see user::User; user::User::id_; last_id_; user::Credentials
    */
   void create_user(string_view args);
 
-  void emplace_user(const UserCredentials& c);
+  /*! Adds an user to the user list, generating its id.
+   *
+   *  Expects users_mutex_ to be held exclusively, or the system to be.
+   *  @see create_user(); last_id_
+   */
+  UserHandle emplace_user(const UserCredentials& c);
 
   /*! Logs in an user in the system.
    *  @param cred the credentials parsed from the login command.
-   *  @see check_credentials(); logged_user_; current_state_
+   *  @see check_credentials(); Context::user; Context::state
    *  @see user::User; user::User::address_
    */
   void user_login(string_view cred);
 
   /*! Disconnects the current user from the system.
-   *  @see current_state_; logged_user_
+   *  @see Context::state; Context::user
    *  @see user::User; user::User::address_
    */
   void disconnect();
 
-  /*! Find the position of an server in the system.
+  /*! Find a server in the system.
    *
-   *  Goes through the entire server list checking if a server has the same
-   *  name as the input one, giving the position of it when it is found. It
-   *  expects that the server being looked for exists.
+   *  Looks up the name index for a server with the same name as the input
+   *  one.
    *  @param name the name to be checked
-   *  @see servers_list_
+   *  @see servers_; servers_by_name_
    *  @see server::Server; server::Server::name_
-   *  @return An iterator pointing to the position of the server in the server
-   * list
+   *  @return The server, which is kept alive even if another session removes
+   *  it meanwhile, or nullptr if there is no such server
    */
-  [[nodiscard]] auto find_server(string_view name);
+  [[nodiscard]] shared_ptr<Server> find_server(string_view name) const;
 
   /*! Creates a server in the system.
-   *  @param name the name of the server to be created.
-   *  @see find_server(); servers_list_
+   *  @param args the name of the server to be created.
+   *  @see parse_name()
+   *  @see find_server(); servers_
    *  @see server::Server::add_member()
    */
-  void create_server(string_view name);
+  void create_server(string_view args);
+
+  /*! Adds a server owned by the input user to the server list.
+   *
+   *  Expects servers_mutex_ to be held exclusively, or the system to be.
+   *  @see create_server()
+   */
+  void emplace_server(int owner_id, string_view name);
+
+  /*! Removes a server, and its name from the index.
+   *
+   *  Expects servers_mutex_ to be held exclusively, or the system to be.
+   *  @see remove_server(); servers_by_name_
+   */
+  void erase_server(ServerHandle h);
 
   /*! Changes the description of a server.
    *
@@ -203,23 +358,24 @@ class System {
 
   /*! Lists all the existing servers in the system.
    *  @see server::Server;
-   *  @see servers_list_
+   *  @see servers_
    */
   void list_servers() const;
 
   /*! Removes a server from the system.
    *
    *  To remove a server, you have to be its owner.
-   *  @see find_server(); servers_list_
+   *  @param args the name of the server.
+   *  @see parse_name(); find_server(); servers_
    *  @see server::Server
    */
-  void remove_server(string_view name);
+  void remove_server(string_view args);
 
   /*! Makes the logged-in user join a server.
    *
    *  If the server has an invite code, and you are not its owner, you have
    *  to input the valid code to be able to enter.
-   *  @see current_server_; current_state_
+   *  @see Context::server; Context::state
    *  @see server::Server; server::ServerDetails
    */
   void enter_server(const ServerDetails& sd);
@@ -230,94 +386,385 @@ class System {
    * current server if you wish to visualize another one. This does not remove
    * an user from the server's members list.
    *  @see server::Server; server::Server::members_ids_
-   *  @see current_server_; current_state_
+   *  @see Context::server; Context::state
    */
   void leave_server();
 
   /*! List all the members of the current server.
-   *  @see current_server_; get_user_name()
+   *  @see Context::server; get_user_name()
    *  @see server::Server::members_ids_
    */
   void list_participants() const;
 
   bool check_channel(const ChannelDetails& cd) const;
 
-  constexpr auto find_channel(string_view name);
-
   void list_channels() const;
 
   void create_channel(string_view args);
 
-  void emplace_channels(string_view name, const vector<ChannelDetails>& v);
+  /*! Adds channels to a server, taking their details over.
+   *  @see TextChannel::TextChannel(ChannelDetails&&)
+   */
+  void emplace_channels(string_view name, std::span<ChannelDetails> v);
 
-  void enter_channel(string_view name);
+  /*! Enters a channel of the current server.
+   *  @param args the name of the channel.
+   *  @see parse_name()
+   */
+  void enter_channel(string_view args);
 
   void leave_channel();
 
   void send_message(string_view msg);
 
-  void list_messages();
+  /*! Lists the messages of the current channel.
+   *  @param args the range of messages to be listed, optionally.
+   *  @see parse_range(); TextChannel::select()
+   */
+  void list_messages(string_view args);
+
+  /*! Searches the messages of the current channel, or of every text channel
+   *  of the current server if the user isn't visualizing a channel.
+   *  @param args the terms to search for, and optionally its filters
+   *  @see parse_query(); TextChannel::search()
+   */
+  void search_messages(string_view args) const;
+
+  /*! Sets the retention policy of the current channel, or of the current
+   *  server if the user isn't visualizing a channel, which the channels
+   *  without a policy of their own follow.
+   *
+   *  To change a policy, you have to be the owner of the server. Without any
+   *  limit, the policy of the channel is removed, or the one of the server
+   *  doesn't limit anything anymore.
+   *  @param args the limits, like "count=N age=DAYS"
+   *  @see parse_retention(); apply_retention()
+   */
+  void set_retention(string_view args);
 
-  void print_message(const Message& m) const;
+  /*! Lists the messages of the current channel that were moved to the
+   *  archive, which is only read by this command.
+   *  @param args the range of messages to be listed, optionally.
+   *  @see parse_range(); Archive::for_each()
+   */
+  void list_archived_messages(string_view args) const;
+
+  /*! Parses the arguments of the search-messages command.
+   *
+   *  The words are the terms looked for, except for "from=EMAIL",
+   *  "after=DATE" and "before=DATE", which are filters.
+   *  @return The query, if the arguments are valid
+   *  @see SearchQuery
+   */
+  [[nodiscard]] std::optional<SearchQuery> parse_query(string_view args) const;
 
+  void print_message(const MessageView& m) const;
+
+  /*! Appends a message, as it's printed, to an output buffer.
+   *  @see list_messages(); user_names_; TimeFormatter
+   */
+  void render_message(string& out, const MessageView& m) const;
+
+  /*! Saves the whole system, replacing the stored files once the new ones
+   *  are durable.
+   *  @see write_files(); commit_files()
+   */
   void save() {
-    save_users();
-    save_servers();
+    wait_for_save();
+    if (const auto files{write_files()}) {
+      commit_files(*files);
+    }
   }
 
   void load() {
-    load_users();
-    load_servers();
+    wait_for_save();
+    finish_commit();
+    if (format_ == StorageFormat::kBinary) {
+      load_snapshot();
+    } else if (format_ == StorageFormat::kSharded) {
+      load_users();
+      load_shards();
+    } else {
+      load_users();
+      load_servers();
+    }
+    load_retention();
   }
 
+  /*! Converts the stored data to another format.
+   *
+   *  Loads the data in the current format, including the journal, and
+   *  compacts it into the input format, which becomes the current one.
+   *  @see StorageFormat; format_
+   */
+  void convert(StorageFormat to);
+
+  /*! Waits for every change journaled so far to be synced to the disk.
+   *  @see set_flush_policy(); Journal::sync()
+   */
+  void sync();
+
+  /*! Starts a batch of the commands of the current session.
+   *
+   *  The changes made by the commands of a batch aren't journaled, and are
+   *  only saved when the batch is committed, or the session ends. The
+   *  commands of the other sessions are journaled as usual.
+   *  @see commit_batch(); Batch; Context::batch
+   */
+  void begin_batch();
+
+  /*! Saves every change made since the batch of the current session started,
+   *  once, and reports how many of its commands were executed and how long
+   *  they took.
+   *  @see begin_batch(); end_batch()
+   */
+  void commit_batch();
+
+  /*! Writes the whole system into the snapshot files and discards the
+   *  journal, as every change recorded in it is now part of the snapshot.
+   *
+   *  With background saves, the files are written aside while the system is
+   *  held, but replaced by another thread, which discards the journal
+   *  records set aside once they are durable.
+   *
+   *  Expects the system to be held exclusively, if other threads use it.
+   *  @see save(); journal_; state_mutex_; background_saves_
+   */
+  void compact();
+
+  /*! Applies every change recorded in the journal since the last compaction.
+   *
+   *  Expects the snapshot files to be already loaded.
+   *  @see load(); journal_
+   */
+  void replay_journal();
+
+  /*! Applies a single journal record to the system.
+   *
+   *  The records of servers or channels that don't exist are ignored, as
+   *  they may have been removed while the change was made.
+   *  @see replay_journal(); record()
+   */
+  void apply_record(string_view r);
+
  private:
   using enum SystemState;
-  SystemState current_state_{kGuest}; /*!< The current state of the system */
-  vector<User> users_list_;     /*!< The list of all users in the system */
-  vector<Server> servers_list_; /*!< The list of all servers in the system */
-  User* current_user_;          /*!< The current logged-in user */
-  Server* current_server_;      /*!< The current server being visualized */
-  Channel* current_channel_;    /*!< The current channel being visualized */
+
+  /*! A struct that contains the files written aside by a save.
+   *  @see write_files(); commit_files()
+   */
+  struct PendingSave {
+    vector<string> written; /*!< The files replaced, without ".tmp". */
+    vector<string> removed; /*!< The files deleted once they're replaced. */
+    uint64_t sequence{}; /*!< The number of the last journal record the
+                            files hold. */
+  };
+
+  /*! A struct that contains the state of the session running a command.
+   *  @see ctx(); attach()
+   */
+  struct Context {
+    SystemState state{kGuest};  /*!< The current state of the session */
+    const User* user{nullptr};  /*!< The current logged-in user */
+    shared_ptr<Server> server;  /*!< The current server being visualized */
+    Channel* channel{nullptr};  /*!< The current channel being visualized */
+    UserHandle user_handle;     /*!< @see user */
+    ServerHandle server_handle; /*!< @see server */
+    ChannelHandle channel_handle; /*!< @see channel */
+    ostream* output{&std::cout}; /*!< Where the output of the commands goes */
+    Session* session{nullptr};   /*!< The session attached, if any */
+    Batch batch; /*!< The batch of the session, if it started one */
+  };
+
+  StorageFormat format_{
+      StorageFormat::kText}; /*!< The format the data is stored in */
+  SlotMap<User> users_; /*!< All the users in the system */
+  SlotMap<shared_ptr<Server>>
+      servers_; /*!< All the servers in the system */
+  mutable Context console_; /*!< The context of the commands of the CLI */
+  static thread_local Context*
+      context_; /*!< The context of the command run by this thread, if any */
+  mutable std::shared_mutex
+      state_mutex_; /*!< The lock of the system as a whole. */
+  mutable std::shared_mutex
+      users_mutex_; /*!< The lock of the user list and its indexes. */
+  mutable std::shared_mutex
+      servers_mutex_; /*!< The lock of the server list and its index. */
+  std::mutex subscribers_mutex_; /*!< The lock of subscribers_. */
+  std::mutex deliveries_mutex_; /*!< The lock of the deliveries to the
+                                   subscribers, so they're delivered one at
+                                   a time, and a session isn't closed while
+                                   a message is delivered to it. It's taken
+                                   before subscribers_mutex_. */
+  unordered_map<const Channel*, vector<Session*>>
+      subscribers_; /*!< The sessions subscribed to each channel. */
   int last_id_{};               /*!< The last user id generated by the system */
-  unordered_set<string> guest_commands_{
-      "create-user", "login"}; /*!< Commands allowed in kGuest state. */
-  unordered_set<string> logged_commands_{
-      "create-server",
-      "set-server-desc",
-      "set-server-invite-code",
-      "list-servers",
-      "remove-server",
-      "enter-server"}; /*!< Commands allowed in kLogged_In state. */
-  unordered_set<string> server_commands_{
-      "leave-server",  "list-participants", "list-channels", "create-channel",
-      "enter-channel", "leave-channel"}; /*! Commands allowed in
-kJoinedServer state. */
-  unordered_set<string> channel_commands_{
-      "send-message",
-      "list-messages"}; /*!< Commands allowed in kJoinedChannel state. */
-  unordered_set<string> save_required_commands_{
-      "create-user",     "create-server",
-      "set-server-desc", "set-server-invite-code",
-      "remove-server",   "create-channel",
-      "send-message"}; /*!< Commands that require saving data. */
-
-  void save_users();
-  void save_servers();
-  void load_users();
-  void load_servers();
-};
+  unordered_map<int, UserHandle>
+      users_by_id_; /*!< The handles of the users, by id. */
+  StringMap<UserHandle>
+      users_by_address_; /*!< The handles of the users, by address. */
+  /*! The names of the users, by id. It's only appended to, which keeps the
+   *  names it holds in place, and only cleared by clear_users() while the
+   *  system is held exclusively, so get_user_name() can hand out views of them.
+   */
+  deque<string> user_names_;
+  StringMap<ServerHandle>
+      servers_by_name_; /*!< The handles of the servers, by name. */
+  int last_shard_{}; /*!< The last number given to a server file. */
+  size_t load_threads_{}; /*!< The threads parsing the server files on load,
+                             or 0 for one per core. */
+  vector<string> removed_shards_; /*!< The files of the servers removed since
+                                     the last save. */
+  vector<int> unloaded_shards_; /*!< The numbers of the server files that
+                                   couldn't be loaded, which are kept in the
+                                   manifest, so they're loaded again the next
+                                   time. */
+  std::atomic<bool> resave_shards_{false}; /*!< If every server file must be
+                                              written, as a save failed. */
+  Journal journal_{"journal.txt"}; /*!< The journal of unsaved changes. */
+  uint64_t saved_sequence_{}; /*!< The number of the last journal record the
+                                 stored files hold, as they were loaded. */
+  Archive archive_{"archive.dat"}; /*!< The messages the retention policies
+                                      don't keep. */
+  bool background_saves_{false}; /*!< If the files written by a compaction
+                                    are made durable by another thread. */
+  bool compress_{false}; /*!< If the binary snapshot stores the messages of
+                            the text channels in compressed blocks. */
+  std::jthread saver_; /*!< The thread making the last compaction durable. */
+  static constexpr size_t kCompactionThreshold{
+      1024}; /*!< The amount of journal records that triggers a compaction. */
+
+  /*! Appends a change to the journal, joining the fields with spaces.
+   *
+   *  Every field but the last is quoted if needed, as the last one is read
+   *  back as the rest of the record.
+   *  @see journal_; apply_record(); append_token()
+   */
+  void record(std::initializer_list<string_view> fields);
 
-// Check if the command input in the CLI is valid.
-bool check_command(const unordered_set<string>& s, string_view c);
+  /*! Compacts the journal if it got too big.
+   *  @see compact(); kCompactionThreshold
+   */
+  void maybe_compact();
 
-// Parse the command part input in the CLI.
-string parse_cmd(string_view cmd_line);
+  /*! Ends a batch, saving the changes it made, if any.
+   *
+   *  Expects the system to be held exclusively.
+   *  @return The batch ended
+   *  @see commit_batch(); close_session(); compact()
+   */
+  Batch end_batch(Batch& b);
 
-// Check if the command input in the CLI has any argument.
-bool check_args(string_view cmd_line);
+  /*! @return The context of the command being run by this thread
+   *  @see context_; console_
+   */
+  [[nodiscard]] Context& ctx() const {
+    return context_ != nullptr ? *context_ : console_;
+  }
+
+  /*! @see Context::output */
+  [[nodiscard]] ostream& output() const { return *ctx().output; }
+
+  /*! Runs a command in the current context, holding the system as the
+   *  command requires.
+   *  @see CommandSpec::exclusive; state_mutex_
+   */
+  void execute(const CommandLine& cl);
+
+  /*! Builds the context of a session.
+   *  @see Session; Context
+   */
+  void attach(Session& s, Context& c);
+
+  /*! Stores the state of a context back into its session, subscribing it to
+   *  the channel it's visualizing.
+   *  @see attach(); subscribe()
+   */
+  void detach(Session& s, const Context& c);
+
+  /*! Moves the subscription of a session to another channel, or cancels it
+   *  if the channel is nullptr.
+   *  @see subscribers_
+   */
+  void subscribe(Session& s, const Channel* c);
+
+  /*! Delivers a message just sent to the sessions subscribed to its channel,
+   *  but the one that sent it.
+   *  @see subscribers_; deliveries_mutex_; Subscriber::deliver()
+   */
+  void publish(const Channel& c, const MessageView& m);
+
+  /*! Writes the system aside, each stored file that changed into a
+   *  temporary one.
+   *  @return The files to be committed, or nullopt if any couldn't be written
+   *  @see commit_files()
+   */
+  std::optional<PendingSave> write_files();
+
+  /*! Commits a save, listing the files written aside in commit.txt once
+   *  they're durable, and then finishes it.
+   *
+   *  Once committed, a save is finished even if a crash stops it, by the
+   *  next load, so the stored files are never part of different saves.
+   *  @return False if the save couldn't be committed or finished
+   *  @see write_files(); finish_commit(); save_commit()
+   */
+  bool commit_files(const PendingSave& files);
+
+  /*! Finishes the save listed in commit.txt, if any, replacing the stored
+   *  files with the ones written aside, and deleting the ones not needed
+   *  anymore, and then takes them out of commit.txt.
+   *
+   *  Reads the number of the last journal record the stored files hold too.
+   *  @return False if any file couldn't be replaced, in which case the save
+   *  is finished later
+   *  @see commit_files(); saved_sequence_; replace_file()
+   */
+  bool finish_commit();
+
+  /*! Waits for the last compaction to be durable.
+   *  @see saver_
+   */
+  void wait_for_save();
+
+  bool save_users(const string& fn);
+  bool save_servers(const string& fn);
+  bool save_snapshot(const string& fn);
+
+  /*! Writes aside the files of the servers that changed, and the manifest.
+   *  @see StorageFormat::kSharded; Server::take_dirty()
+   */
+  bool save_shards(PendingSave& files);
+
+  /*! Writes aside the retention policies, which are stored apart from the
+   *  servers in every format, or deletes their file if there is none.
+   *  @see load_retention()
+   */
+  bool save_retention(PendingSave& files);
+
+  /*! Replaces commit.txt with the files of a save, and the number of the
+   *  last journal record they hold, which is skipped when the journal is
+   *  replayed.
+   *  @see finish_commit(); saved_sequence_; Journal::replay()
+   */
+  bool save_commit(const PendingSave& files);
+
+  /*! Moves the messages that the retention policies don't keep to the
+   *  archive, before the system is saved.
+   *  @see RetentionPolicy; TextChannel::for_each_expired(); archive_
+   */
+  void apply_retention();
+  void load_retention();
+  void load_shards();
+  void load_users();
+  void load_servers();
+  void load_snapshot();
+  void clear_users();
+  void clear_servers();
+};
 
-// Parse the argument part input in the CLI.
-string parse_args(string_view cmd_line);
+// Get the type of a channel as written in the create-channel command.
+string_view channel_type(const Channel& c);
 
 // Parse the details in the argument of a server command that needs it.
 ServerDetails parse_details(string_view args, int cmd);
@@ -344,24 +791,54 @@ bool check_channel_name(const unique_ptr<Channel>& c, string_view name);
 
 ChannelDetails parse_details(string_view args);
 
-UserCredentials parse_users_file(fstream& f);
-vector<int> parse_members_ids(fstream& f, int up_bound);
-ServerDetails parse_server_details(fstream& f);
-time_t string_to_time(const string& s);
-MessageDetails parse_message(fstream& f);
-ChannelDetails parse_channel_details(fstream& f);
-pair<ServerDetails, vector<ChannelDetails>> parse_servers_file(fstream& f);
-
-// Some functions that print to the cout.
-void print_absent(string_view name);
-void print_no_permission(string_view sv);
-void print_info_changed(tuple<string_view, string_view, string_view> info);
-void print_info_changed(string_view wc1, const Server& s, string_view wc2);
-void print_unable();
-void print_channel_created(const ChannelDetails& cd);
-void print_channel_created(string_view type, string_view name);
-void print_channel_exists(const ChannelDetails& cd);
-void print_channel_exists(string_view type, string_view name);
+// Parse the name that is the only argument of a command, if it's valid. It's
+// read as a single token, like the names followed by other arguments, so it
+// must be quoted if it has spaces, and it can't have double quotes.
+std::optional<string_view> parse_name(string_view args);
+
+// Check if a name can be given to a server or channel, which is read back
+// whole by Tokenizer::next().
+bool valid_name(string_view name);
+
+// Parse the range of messages to be listed, if it's valid.
+std::optional<MessageRange> parse_range(string_view args);
+
+// Parse the limits of a retention policy, like "count=N age=DAYS", if they're
+// valid.
+std::optional<RetentionPolicy> parse_retention(string_view args);
+
+// Write a retention policy as it's parsed.
+string retention_to_string(const RetentionPolicy& p);
+
+// The details read from the files are allocated with the input allocator.
+// The messages of the text channels are left in the input message file, which
+// f reads.
+UserCredentials parse_users_file(fstream& f, DetailsAllocator alloc = {});
+std::pmr::vector<int> parse_members_ids(fstream& f, int up_bound,
+                                        DetailsAllocator alloc = {});
+ServerDetails parse_server_details(fstream& f, DetailsAllocator alloc = {});
+MessageDetails parse_message(fstream& f, DetailsAllocator alloc = {});
+ChannelDetails parse_channel_details(fstream& f,
+                                     const shared_ptr<MessageFile>& file,
+                                     DetailsAllocator alloc = {});
+pair<ServerDetails, std::pmr::vector<ChannelDetails>> parse_servers_file(
+    fstream& f, const shared_ptr<MessageFile>& file,
+    DetailsAllocator alloc = {});
+
+// Some functions that print the output of the commands.
+void print_absent(ostream& out, string_view name);
+void print_no_permission(ostream& out, string_view sv);
+void print_info_changed(ostream& out,
+                        tuple<string_view, string_view, string_view> info);
+void print_info_changed(ostream& out, string_view wc1, const Server& s,
+                        string_view wc2);
+void print_unable(ostream& out);
+void print_invalid_name(ostream& out);
+void print_invalid_type(ostream& out);
+void print_channel_created(ostream& out, const ChannelDetails& cd);
+void print_channel_created(ostream& out, string_view type, string_view name);
+void print_channel_exists(ostream& out, const ChannelDetails& cd);
+void print_channel_exists(ostream& out, string_view type, string_view name);
 void print_file_error(string_view filename);
 
 template <typename Container, typename Parameter, typename Predicate>
@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+namespace concordo {
+
+using std::deque, std::unique_ptr, std::vector;
+
+/*! A class that runs tasks on a fixed set of threads.
+ *
+ *  Every thread has its own queue, to which the tasks are handed in turns.
+ *  A thread runs the newest task of its own queue, and when it's empty,
+ *  steals the oldest task of another one, so the threads given the longer
+ *  tasks don't hold the others back.
+ */
+class ThreadPool {
+ public:
+  /*! @param threads the amount of threads, or 0 for one per core */
+  explicit ThreadPool(size_t threads = 0);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool& operator=(ThreadPool&&) = delete;
+
+  /*! Runs the tasks still queued, and then stops the threads. */
+  ~ThreadPool();
+
+  /*! Queues a task to be run by one of the threads. */
+  void submit(std::function<void()> task);
+
+  /*! Waits for every task submitted so far to finish. */
+  void wait();
+
+  [[nodiscard]] size_t size() const { return workers_.size(); }
+
+ private:
+  /*! A queue of tasks, which is locked by its owner and by the thieves. */
+  struct Queue {
+    std::mutex mutex;
+    deque<std::function<void()>> tasks;
+  };
+
+  vector<unique_ptr<Queue>> queues_; /*!< The queue of every thread. */
+  std::atomic<size_t> next_{}; /*!< The queue the next task is handed to. */
+  std::atomic<size_t> pending_{}; /*!< The tasks submitted, not finished. */
+  std::counting_semaphore<> queued_{
+      0}; /*!< The tasks queued, not taken by any thread. */
+  std::atomic<bool> stopping_{false};
+  vector<std::jthread> workers_;
+
+  /*! Runs tasks until the pool stops.
+   *  @param self the position of the thread, and of its queue
+   */
+  void work(size_t self);
+
+  /*! Takes a task, from the back of the thread's queue or from the front of
+   *  another one.
+   */
+  std::function<void()> take(size_t self);
+};
+
+}  // namespace concordo
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <array>
+#include <cstddef>
+#include <ctime>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace concordo {
+
+using std::string, std::string_view;
+
+/*! A struct that contains a date and time of the proleptic Gregorian
+ *  calendar, without any time zone.
+ */
+struct CivilTime {
+  int year{1970};
+  int month{1}; /*!< From 1 to 12. */
+  int day{1};   /*!< From 1 to 31. */
+  int hour{};
+  int minute{};
+  int second{};
+};
+
+/*! @return The date and time of a timestamp in UTC */
+CivilTime to_civil(time_t t);
+
+/*! @return The timestamp of a date and time in UTC */
+time_t from_civil(const CivilTime& c);
+
+/*! Finds how far the local time zone is ahead of UTC at a timestamp, which can
+ *  be called by many threads at once.
+ *  @return The offset, in seconds
+ */
+long local_offset(time_t t);
+
+/*! The length of a timestamp written like "2026-10-16T15:47:03Z". */
+constexpr size_t kIsoTimeLength{20};
+
+/*! Writes a timestamp in UTC, as ISO 8601 with a fixed width.
+ *  @param out where the kIsoTimeLength characters are written
+ *  @return The end of what was written
+ */
+char* write_iso_time(time_t t, char* out);
+
+/*! Reads a timestamp written by write_iso_time().
+ *  @return The timestamp, or nullopt if it isn't written like one
+ */
+std::optional<time_t> parse_iso_time(string_view s);
+
+/*! Reads a date in the local time zone, written as the messages are shown,
+ *  like "16/10/2026 - 15:47" or "6/3/2026-9:05".
+ *  @return The timestamp, or nullopt if it isn't written like one
+ */
+std::optional<time_t> parse_local_time(string_view s);
+
+/*! A class that formats the dates of messages for display.
+ *
+ *  The dates are shown with minute precision, so the last minute formatted is
+ *  cached, and the messages sent in the same minute are formatted without any
+ *  conversion. Nothing is allocated to format a date.
+ *  @see parse_local_time()
+ */
+class TimeFormatter {
+ public:
+  /*! Formats a date like "16/10/2026 - 15:47", in the local time zone.
+   *  @return A view of the formatted date, valid until the next call
+   */
+  string_view format(time_t t);
+
+ private:
+  static constexpr time_t kNoMinute{std::numeric_limits<time_t>::min()};
+
+  time_t minute_{kNoMinute}; /*!< The minute formatted into buffer_. */
+  std::array<char, 32> buffer_{};
+  size_t length_{};
+};
+
+/*! @return The timestamp as it's stored, like "2026-10-16T15:47:03Z"
+ *  @see write_iso_time()
+ */
+string time_to_string(const time_t& t);
+
+/*! Reads a stored timestamp, which older files wrote in the local time zone
+ *  and with minute precision, like the dates shown.
+ *  @return The timestamp, or 0 if it isn't written like one
+ *  @see parse_iso_time(); parse_local_time()
+ */
+time_t string_to_time(string_view s);
+
+}  // namespace concordo
+
+#endif  // TIMESTAMP_H
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace concordo {
+
+using std::string, std::string_view;
+
+/*! A class that splits a line input to the CLI into tokens.
+ *
+ *  The line is read a single time, from left to right, and every token is a
+ *  view of it, so nothing is copied. Tokens are separated by spaces, and a
+ *  token between double quotes may contain spaces (but not double quotes),
+ *  like a name in `set-server-desc "My server" A nice server`.
+ *  @see concordo::System::run(); concordo::System::apply_record()
+ */
+class Tokenizer {
+ public:
+  explicit Tokenizer(string_view line) : line_{line} {}
+
+  /*! Reads the next token.
+   *  @return The token without its quotes, or nullopt if there is none left
+   */
+  std::optional<string_view> next();
+
+  /*! Reads the rest of the line as a single token, like the name of a user.
+   *
+   *  The leading spaces are skipped, and if the rest is a single quoted token
+   *  its quotes are removed.
+   */
+  string_view rest();
+
+  /*! Reads the rest of the line as is, like the content of a message.
+   *
+   *  Only the space that separates it from the last token is skipped.
+   */
+  string_view raw();
+
+  /*! Checks if there is no token left. */
+  [[nodiscard]] bool empty() const;
+
+ private:
+  string_view line_; /*!< The part of the line not read yet. */
+
+  void skip_spaces();
+};
+
+/*! Appends a token to a line, quoting it if it wouldn't be read back whole
+ *  by Tokenizer::next().
+ */
+void append_token(string& line, string_view token);
+
+}  // namespace concordo
+
+#endif  // TOKENIZER_H
@@ -6,6 +6,7 @@
 #define USERS_H
 
 #include <fstream>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 
@@ -22,10 +23,16 @@ using std::string, std::string_view, std::ostream, std::fstream;
  *  @see User; User::name_; User::address_; User::password_
  */
 struct UserCredentials {
-  int id;
-  string address;  /*!< An user email address to be input from the system. */
-  string password; /*!< An user password to be input from the system. */
-  string name;     /*!< An user name to be input from the system. */
+  UserCredentials() = default;
+  explicit UserCredentials(DetailsAllocator a)
+      : address{a}, password{a}, name{a} {}
+
+  int id{};
+  std::pmr::string address;  /*!< An user email address to be input from the
+                                system. */
+  std::pmr::string password; /*!< An user password to be input from the
+                                system. */
+  std::pmr::string name;     /*!< An user name to be input from the system. */
 };
 
 /*! A class that represents an user in the Concordo app.
@@ -37,7 +44,7 @@ struct UserCredentials {
 class User {
  public:
   /*! Default constructor to be used by std::vector class.
-   *  @see concordo::System::users_list_
+   *  @see concordo::System::users_
    */
   User() = default;
 
@@ -63,11 +70,20 @@ class User {
     return password_ == p;
   }
 
-  void send_message(Channel* c, string_view msg) const {
-    c->send_message({id_, msg});
+  /*! Sends a message to a channel, dated now.
+   *  @return The message that was sent, whose content is the input one
+   */
+  MessageView send_message(Channel* c, string_view msg) const {
+    const MessageView m{system_clock::to_time_t(system_clock::now()), id_,
+                        msg};
+    c->send_message(m);
+    return m;
   }
 
-  void save(fstream& f);
+  void save(fstream& f) const;
+  void save(SnapshotWriter& w) const {
+    w.add_user(id_, name_, address_, password_);
+  }
 
   friend ostream& operator<<(ostream& out, const User& u);
 
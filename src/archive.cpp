@@ -0,0 +1,235 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "archive.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <utility>
+
+#include "compression.h"
+#include "files.h"
+
+namespace concordo {
+
+namespace {
+
+// The header of a block, which is followed by the names of its server and
+// channel, and then its compressed messages. A block without messages nor a
+// channel is the tombstone of its server.
+struct BlockHeader {
+  uint32_t server_size;
+  uint32_t channel_size;
+  uint32_t messages_count;
+  uint32_t raw_size;
+  uint32_t size;  // The size of the compressed messages.
+
+  [[nodiscard]] bool tombstone() const {
+    return messages_count == 0 && channel_size == 0;
+  }
+};
+
+// The size of a message in a block, besides its content.
+constexpr size_t kMessageSize{sizeof(int64_t) + sizeof(int32_t) +
+                              sizeof(uint32_t)};
+
+template <typename T>
+void put(string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(const char*& p) {
+  T value;
+  std::memcpy(&value, p, sizeof(value));
+  p += sizeof(value);
+  return value;
+}
+
+// Reads a part of the file whole, or nothing.
+bool read(std::ifstream& f, char* out, size_t n) {
+  f.read(out, static_cast<std::streamsize>(n));
+  return static_cast<size_t>(f.gcount()) == n;
+}
+
+// Reads the header of the next block and the names after it.
+bool read_header(std::ifstream& f, BlockHeader& h, string& names) {
+  if (!read(f, reinterpret_cast<char*>(&h), sizeof(h))) {
+    return false;
+  }
+  names.resize(size_t{h.server_size} + h.channel_size);
+  return read(f, names.data(), names.size());
+}
+
+}  // namespace
+
+void Archive::add(string_view server, string_view channel,
+                  const MessageView& m) {
+  if (block_messages_ > 0 && (server != server_ || channel != channel_)) {
+    flush_block();
+  }
+  server_ = server;
+  channel_ = channel;
+  put(block_, static_cast<int64_t>(m.date_time));
+  put(block_, static_cast<int32_t>(m.sender_id));
+  put(block_, static_cast<uint32_t>(m.content.size()));
+  block_ += m.content;
+  ++block_messages_;
+  if (block_.size() >= kBlockSize) {
+    flush_block();
+  }
+}
+
+void Archive::flush_block() {
+  if (block_messages_ == 0) {
+    return;
+  }
+  const string data{compress(block_)};
+  pending_counts_[server_][channel_] += block_messages_;
+  put(pending_, BlockHeader{static_cast<uint32_t>(server_.size()),
+                            static_cast<uint32_t>(channel_.size()),
+                            std::exchange(block_messages_, 0),
+                            static_cast<uint32_t>(block_.size()),
+                            static_cast<uint32_t>(data.size())});
+  pending_ += server_;
+  pending_ += channel_;
+  pending_ += data;
+  block_.clear();
+}
+
+bool Archive::write() {
+  flush_block();
+  const string blocks{std::exchange(pending_, {})};
+  const Counts added{std::exchange(pending_counts_, {})};
+  if (blocks.empty()) {
+    return true;
+  }
+  count();
+  if (!append_file(filename_, blocks)) {
+    return false;
+  }
+  for (const auto& [server, channels] : added) {
+    for (const auto& [channel, n] : channels) {
+      counts_[server][channel] += n;
+    }
+  }
+  return true;
+}
+
+// A server that never had any message archived needs no tombstone.
+bool Archive::forget(string_view server) {
+  std::error_code ec;
+  if (!std::filesystem::exists(filename_, ec)) {
+    return !ec;
+  }
+  count();
+  string tombstone;
+  put(tombstone, BlockHeader{static_cast<uint32_t>(server.size()), 0, 0, 0, 0});
+  tombstone += server;
+  if (!append_file(filename_, tombstone)) {
+    return false;
+  }
+  if (const auto it{counts_.find(server)}; it != counts_.end()) {
+    counts_.erase(it);
+  }
+  return true;
+}
+
+size_t Archive::archived(string_view server, string_view channel) {
+  count();
+  const auto it{counts_.find(server)};
+  if (it == counts_.end()) {
+    return 0;
+  }
+  const auto c{it->second.find(channel)};
+  return c != it->second.end() ? c->second : 0;
+}
+
+void Archive::count() {
+  if (counted_) {
+    return;
+  }
+  counted_ = true;
+  std::error_code ec;
+  const uintmax_t size{std::filesystem::file_size(filename_, ec)};
+  if (ec) {
+    return;
+  }
+  std::ifstream f{filename_, std::ios::binary};
+  BlockHeader h{};
+  string names;
+  uintmax_t end{0};
+  while (read_header(f, h, names)) {
+    const uintmax_t next{end + sizeof(h) + names.size() + h.size};
+    if (next > size) {
+      break;
+    }
+    const string_view n{names};
+    if (h.tombstone()) {
+      counts_.erase(names);
+    } else {
+      counts_[string{n.substr(0, h.server_size)}]
+             [string{n.substr(h.server_size)}] += h.messages_count;
+    }
+    end = next;
+    f.seekg(static_cast<std::streamoff>(end));
+  }
+  if (end < size) {
+    std::filesystem::resize_file(filename_, end, ec);
+  }
+}
+
+// A block that can't be read whole ends the archive, as it can only be the
+// last one, cut by a crash.
+void Archive::for_each(
+    string_view server, string_view channel,
+    const std::function<void(const MessageView&)>& visitor) const {
+  std::ifstream f{filename_, std::ios::binary};
+  BlockHeader h{};
+  string names;
+  // The blocks before the last tombstone of the server are of the servers
+  // removed with its name, so only the headers are read until it's found.
+  std::streampos first{0};
+  while (read_header(f, h, names)) {
+    if (h.tombstone() && names == server) {
+      first = f.tellg();
+    }
+    f.seekg(h.size, std::ios::cur);
+  }
+  f.clear();
+  f.seekg(first);
+  string data;
+  string raw;
+  while (read_header(f, h, names)) {
+    const string_view n{names};
+    if (n.substr(0, h.server_size) != server ||
+        n.substr(h.server_size) != channel) {
+      f.seekg(h.size, std::ios::cur);
+      continue;
+    }
+    data.resize(h.size);
+    if (!read(f, data.data(), data.size()) ||
+        !decompress(data, h.raw_size, raw)) {
+      return;
+    }
+    const char* p{raw.data()};
+    const char* const end{raw.data() + raw.size()};
+    for (uint32_t i{0}; i < h.messages_count; ++i) {
+      if (static_cast<size_t>(end - p) < kMessageSize) {
+        return;
+      }
+      const auto date_time{get<int64_t>(p)};
+      const auto sender_id{get<int32_t>(p)};
+      const auto length{get<uint32_t>(p)};
+      if (static_cast<size_t>(end - p) < length) {
+        return;
+      }
+      visitor({static_cast<time_t>(date_time), sender_id, {p, length}});
+      p += length;
+    }
+  }
+}
+
+}  // namespace concordo
@@ -4,24 +4,537 @@
 
 #include "channels.h"
 
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <limits>
+#include <mutex>
+
 namespace concordo {
 
-void Message::save(fstream& f) {
-  f << sender_id_ << '\n';
-  f << time_to_string(date_time_) << '\n';
-  f << content_ << '\n';
+namespace ranges = std::ranges;
+
+namespace {
+
+// The channels of a server read from the same stream, whose position they
+// move, and are locked independently, so the reads run one at a time.
+std::mutex text_file_mutex;
+
+void save_message(fstream& f, const MessageView& m) {
+  f << m.sender_id << '\n';
+  std::array<char, kIsoTimeLength> date{};
+  write_iso_time(m.date_time, date.data());
+  f.write(date.data(), date.size()) << '\n';
+  f << m.content << '\n';
+}
+
+void save_message(SnapshotWriter& w, const MessageView& m) {
+  w.add_message(m.date_time, m.sender_id, m.content);
+}
+
+}  // namespace
+
+void Message::save(fstream& f) const { save_message(f, view()); }
+
+void Message::save(SnapshotWriter& w) const { save_message(w, view()); }
+
+MessageView MessageLogIterator::operator*() const {
+  return log_->chunks_[chunk_]->at(pos_);
+}
+
+MessageLogIterator& MessageLogIterator::operator++() {
+  if (++pos_ == log_->chunks_[chunk_]->headers.size() &&
+      chunk_ + 1 < log_->chunks_.size()) {
+    ++chunk_;
+    pos_ = 0;
+  }
+  return *this;
+}
+
+MessageView MessageLog::Chunk::at(size_t pos) const {
+  const Header& h{headers[pos]};
+  const size_t end{pos + 1 < headers.size() ? headers[pos + 1].offset : used};
+  return {h.date_time, h.sender_id, {arena.get() + h.offset, end - h.offset}};
+}
+
+void MessageLog::push_back(const MessageView& m) {
+  const size_t length{m.content.size()};
+  if (chunks_.empty() || chunks_.back()->headers.size() == kChunkMessages ||
+      chunks_.back()->capacity - chunks_.back()->used < length) {
+    auto c{std::make_unique<Chunk>()};
+    c->capacity = std::max(kArenaSize, length);
+    c->arena = std::make_unique_for_overwrite<char[]>(c->capacity);
+    c->headers.reserve(kChunkMessages);
+    starts_.push_back(size_);
+    chunks_.push_back(std::move(c));
+  }
+  Chunk& c{*chunks_.back()};
+  c.headers.push_back(
+      {m.date_time, m.sender_id, static_cast<uint32_t>(c.used)});
+  ranges::copy(m.content, c.arena.get() + c.used);
+  c.used += length;
+  ++size_;
+}
+
+MessageView MessageLog::operator[](size_t i) const {
+  const auto it{ranges::upper_bound(starts_, i) - 1};
+  return chunks_[static_cast<size_t>(it - starts_.begin())]->at(i - *it);
+}
+
+std::pair<size_t, size_t> MessageLog::sent_between(time_t after,
+                                                   time_t before) const {
+  // Finds the first message from lo onwards that wasn't sent before t.
+  const auto sent_from = [this](size_t lo, time_t t) {
+    size_t hi{size_};
+    while (lo < hi) {
+      const size_t mid{lo + (hi - lo) / 2};
+      if ((*this)[mid].date_time < t) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  };
+  const size_t first{sent_from(0, after)};
+  return {first, sent_from(first, before)};
+}
+
+MessageLog::Slice MessageLog::select(const MessageRange& r) const {
+  auto [first, last] = sent_between(r.after, r.before);
+  last -= std::min(r.offset, last - first);
+  return slice(last - std::min(r.limit, last - first), last);
+}
+
+MessageLog::Iterator MessageLog::iterator_at(size_t i) const {
+  if (i >= size_) {
+    // The end is right after the last message of the last chunk.
+    return chunks_.empty() ? Iterator{this, 0, 0}
+                           : Iterator{this, chunks_.size() - 1,
+                                      chunks_.back()->headers.size()};
+  }
+  const auto it{ranges::upper_bound(starts_, i) - 1};
+  return {this, static_cast<size_t>(it - starts_.begin()), i - *it};
+}
+
+bool MessageFile::pin() {
+  const std::scoped_lock lock{text_file_mutex};
+  if (!stream_) {
+    stream_ = std::make_unique<fstream>(filename_, std::ios::in);
+  }
+  pinned_ = static_cast<bool>(*stream_);
+  if (!pinned_) {
+    stream_.reset();
+  }
+  return pinned_;
+}
+
+bool MessageFile::read(const std::function<void(fstream&)>& reader) {
+  const std::scoped_lock lock{text_file_mutex};
+  if (!stream_) {
+    stream_ = std::make_unique<fstream>(filename_, std::ios::in);
+  }
+  const bool opened{static_cast<bool>(*stream_)};
+  if (opened) {
+    stream_->clear();
+    reader(*stream_);
+  } else {
+    std::cerr << "Could not open '" << filename_ << "'!\n";
+  }
+  if (!pinned_) {
+    stream_.reset();
+  }
+  return opened;
+}
+
+// The messages dropped are skipped as parse_channel_details() does, without
+// being parsed.
+bool TextMessageSource::read(
+    const std::function<void(fstream&)>& reader) const {
+  return file_->read([&](fstream& f) {
+    f.seekg(pos_);
+    for (size_t i{0}; i < skip_ * 3; ++i) {
+      f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    reader(f);
+  });
+}
+
+bool TextMessageSource::for_each(
+    const std::function<void(const MessageView&)>& visitor) const {
+  return read([&](fstream& f) {
+    string sender_id;
+    string date_time;
+    string content;
+    for (size_t i{0}; i < size_; ++i) {
+      getline(f, sender_id);
+      getline(f, date_time);
+      getline(f, content);
+      visitor({string_to_time(date_time), std::stoi(sender_id), content});
+    }
+  });
+}
+
+size_t TextMessageSource::for_each_first(
+    size_t n, time_t before,
+    const std::function<void(const MessageView&)>& visitor) const {
+  size_t i{0};
+  read([&](fstream& f) {
+    string sender_id;
+    string date_time;
+    string content;
+    for (; i < size_; ++i) {
+      getline(f, sender_id);
+      getline(f, date_time);
+      getline(f, content);
+      const MessageView m{string_to_time(date_time), std::stoi(sender_id),
+                          content};
+      if (i >= n && m.date_time >= before) {
+        break;
+      }
+      visitor(m);
+    }
+  });
+  return i;
+}
+
+shared_ptr<const MessageSource> TextMessageSource::drop_first(size_t n) const {
+  if (n >= size_) {
+    return nullptr;
+  }
+  return std::make_shared<TextMessageSource>(file_, pos_, size_ - n,
+                                             skip_ + n);
+}
+
+bool SnapshotMessageSource::for_each(
+    const std::function<void(const MessageView&)>& visitor) const {
+  for (const auto& m : snapshot_->messages(record_)) {
+    visitor({m.date_time, m.sender_id, snapshot_->str(m.content)});
+  }
+  return true;
+}
+
+size_t SnapshotMessageSource::for_each_first(
+    size_t n, time_t before,
+    const std::function<void(const MessageView&)>& visitor) const {
+  size_t i{0};
+  for (const auto& m : snapshot_->messages(record_)) {
+    if (i >= n && m.date_time >= before) {
+      break;
+    }
+    visitor({m.date_time, m.sender_id, snapshot_->str(m.content)});
+    ++i;
+  }
+  return i;
+}
+
+shared_ptr<const MessageSource> SnapshotMessageSource::drop_first(
+    size_t n) const {
+  if (n >= size()) {
+    return nullptr;
+  }
+  ChannelRecord r{record_};
+  r.first_message += static_cast<uint32_t>(n);
+  r.messages_count -= static_cast<uint32_t>(n);
+  return std::make_shared<SnapshotMessageSource>(snapshot_, r);
+}
+
+shared_ptr<const MessageSource> MessageSource::for_each_last(
+    size_t /*n*/,
+    const std::function<void(const MessageView&)>& visitor) const {
+  if (!for_each(visitor)) {
+    return shared_from_this();
+  }
+  return nullptr;
+}
+
+bool MessageSource::save(SnapshotWriter& w) const {
+  return for_each([&](const MessageView& m) { save_message(w, m); });
+}
+
+CompressedMessageSource::CompressedMessageSource(
+    shared_ptr<const Snapshot> s, std::span<const BlockRecord> blocks,
+    size_t skip)
+    : snapshot_{std::move(s)}, blocks_{blocks}, skip_{skip} {
+  for (const auto& b : blocks_) {
+    size_ += b.messages_count;
+  }
+  size_ -= std::min(skip_, size_);
+}
+
+void CompressedMessageSource::for_each_in(
+    std::span<const BlockRecord> blocks, size_t skip,
+    const std::function<void(const MessageView&)>& visitor) const {
+  for (const auto& b : blocks) {
+    snapshot_->for_each_message(
+        b, [&](time_t date_time, int sender_id, string_view content) {
+          if (skip > 0) {
+            --skip;
+            return;
+          }
+          visitor({date_time, sender_id, content});
+        });
+  }
+}
+
+bool CompressedMessageSource::for_each(
+    const std::function<void(const MessageView&)>& visitor) const {
+  for_each_in(blocks_, skip_, visitor);
+  return true;
+}
+
+shared_ptr<const MessageSource> CompressedMessageSource::for_each_last(
+    size_t n, const std::function<void(const MessageView&)>& visitor) const {
+  size_t first{blocks_.size()};
+  for (size_t read{0}; first > 0 && read < n;) {
+    read += blocks_[--first].messages_count;
+  }
+  for_each_in(blocks_.subspan(first), first == 0 ? skip_ : 0, visitor);
+  if (first == 0) {
+    return nullptr;
+  }
+  return std::make_shared<CompressedMessageSource>(
+      snapshot_, blocks_.first(first), skip_);
+}
+
+// A block whose first message wasn't sent before the date has no message
+// that was, so it isn't decompressed, unless some of its messages were
+// dropped or are among the first n.
+size_t CompressedMessageSource::for_each_first(
+    size_t n, time_t before,
+    const std::function<void(const MessageView&)>& visitor) const {
+  size_t read{0};
+  bool done{false};
+  for (size_t skip{skip_}; const auto& b : blocks_) {
+    if (done || (skip == 0 && read >= n && b.first_date >= before)) {
+      break;
+    }
+    snapshot_->for_each_message(
+        b, [&](time_t date_time, int sender_id, string_view content) {
+          if (skip > 0) {
+            --skip;
+          } else if (!done && (read < n || date_time < before)) {
+            visitor({date_time, sender_id, content});
+            ++read;
+          } else {
+            done = true;
+          }
+        });
+  }
+  return read;
+}
+
+shared_ptr<const MessageSource> CompressedMessageSource::drop_first(
+    size_t n) const {
+  if (n >= size_) {
+    return nullptr;
+  }
+  size_t skip{skip_ + n};
+  size_t first{0};
+  while (skip >= blocks_[first].messages_count) {
+    skip -= blocks_[first++].messages_count;
+  }
+  return std::make_shared<CompressedMessageSource>(
+      snapshot_, blocks_.subspan(first), skip);
+}
+
+// The last block is decompressed, so the messages sent after it are
+// compressed with it, instead of into a smaller block of their own. So is
+// the first one if some of its messages were dropped.
+bool CompressedMessageSource::save(SnapshotWriter& w) const {
+  if (!w.compressing() || blocks_.empty()) {
+    return MessageSource::save(w);
+  }
+  const auto save = [&](const MessageView& m) { save_message(w, m); };
+  const size_t first{skip_ > 0 ? size_t{1} : 0};
+  if (first > 0) {
+    for_each_in(blocks_.first(1), skip_, save);
+  }
+  if (blocks_.size() > first) {
+    for (const auto& b : blocks_.subspan(first, blocks_.size() - first - 1)) {
+      w.add_block(b, snapshot_->str(b.data));
+    }
+    for_each_in(blocks_.last(1), 0, save);
+  }
+  return true;
+}
+
+void TextChannel::load_messages() const {
+  if (!source_) {
+    return;
+  }
+  MessageLog log;
+  if (!source_->for_each([&](const MessageView& m) { log.push_back(m); })) {
+    return;
+  }
+  source_.reset();
+  prepend(std::move(log));
+}
+
+// The messages read go back from the newest one, and as they're sorted by
+// their dates, the older ones left stored were all sent before the first one
+// read.
+bool TextChannel::covers(const MessageRange& r) const {
+  if (!source_) {
+    return true;
+  }
+  if (messages_.empty()) {
+    return false;
+  }
+  const time_t first{messages_[0].date_time};
+  if (first < r.after) {
+    return true;
+  }
+  const size_t last{messages_.sent_between(r.after, r.before).second};
+  return first < r.before && last >= r.offset && last - r.offset >= r.limit;
 }
 
+// Every time the range isn't covered, twice as many messages are read, so
+// the ones in memory are joined to them a few times only.
+void TextChannel::load_range(const MessageRange& r) const {
+  const size_t max{std::numeric_limits<size_t>::max()};
+  size_t wanted{r.limit > max - r.offset ? max : r.offset + r.limit};
+  wanted = std::max<size_t>(wanted, 1);
+  while (!covers(r)) {
+    MessageLog log;
+    auto older{source_->for_each_last(
+        wanted, [&](const MessageView& m) { log.push_back(m); })};
+    if (older == source_) {
+      return;
+    }
+    source_ = std::move(older);
+    prepend(std::move(log));
+    wanted = wanted > max / 2 ? max : wanted * 2;
+  }
+}
+
+void TextChannel::prepend(MessageLog&& log) const {
+  for (const auto m : messages_) {
+    log.push_back(m);
+  }
+  messages_ = std::move(log);
+  if (!source_) {
+    build_index();
+  }
+}
+
+void TextChannel::build_index() const {
+  index_.clear();
+  for (size_t i{0}; const auto m : messages_) {
+    index_.add(i++, m.content);
+  }
+}
+
+// Both limits remove the oldest messages, so the policy removes as many as
+// the stricter of them: the first n, and then the ones sent before the
+// oldest date kept.
+size_t TextChannel::for_each_expired(
+    const RetentionPolicy& p, time_t now, size_t min,
+    const std::function<void(const MessageView&)>& visitor) const {
+  size_t n{min};
+  if (p.max_messages > 0 && size() > p.max_messages) {
+    n = std::max(n, size() - p.max_messages);
+  }
+  time_t before{std::numeric_limits<time_t>::min()};
+  if (p.max_age.count() > 0) {
+    const std::chrono::seconds age{p.max_age};
+    before = now - static_cast<time_t>(age.count());
+  }
+  size_t read{0};
+  if (source_) {
+    read = source_->for_each_first(n, before, visitor);
+    if (read < source_->size()) {
+      return read;
+    }
+  }
+  for (const auto m : messages_) {
+    if (read >= n && m.date_time >= before) {
+      break;
+    }
+    visitor(m);
+    ++read;
+  }
+  return read;
+}
+
+// The index is only built once every stored message is read, so it's built
+// again only if the messages removed weren't all stored.
+void TextChannel::archive_oldest(size_t n) {
+  archived_ += n;
+  if (source_) {
+    const size_t stored{source_->size()};
+    source_ = source_->drop_first(n);
+    if (n < stored) {
+      return;
+    }
+    n -= stored;
+  }
+  MessageLog kept;
+  for (const auto m : messages_.slice(std::min(n, messages_.size()),
+                                      messages_.size())) {
+    kept.push_back(m);
+  }
+  messages_ = std::move(kept);
+  build_index();
+}
+
+void TextChannel::send_message(const MessageView& m) {
+  // While the stored messages weren't read, the index is left to be built
+  // when they are.
+  if (!source_) {
+    index_.add(messages_.size(), m.content);
+  }
+  messages_.push_back(m);
+}
+
+MessageLog::Slice TextChannel::select(const MessageRange& r) const {
+  load_range(r);
+  return messages_.select(r);
+}
+
+vector<size_t> TextChannel::search(const SearchQuery& q) const {
+  load_messages();
+  const auto [first, last] = messages_.sent_between(q.after, q.before);
+  vector<size_t> found{index_.search(q.terms)};
+  std::erase_if(found, [&](size_t i) {
+    return i < first || i >= last ||
+           (q.sender_id && messages_[i].sender_id != *q.sender_id);
+  });
+  return found;
+}
+
+// The messages archived are counted after the type, only if there's any, so
+// the files of the channels without them stay as they were.
 void TextChannel::save(fstream& f) {
   f << getName() << '\n';
-  f << "TEXT\n";
-  f << messages_.size() << '\n';
+  f << "TEXT";
+  if (archived_ > 0) {
+    f << ' ' << archived_;
+  }
+  f << '\n';
+  f << size() << '\n';
   save_messages(f);
 }
 
+// The messages that weren't read yet are copied straight from their source.
+// If they can't be read, the file fails, so it doesn't replace the old one.
 void TextChannel::save_messages(fstream& f) {
-  for (auto& m : messages_) {
-    m.save(f);
+  if (source_ &&
+      !source_->for_each([&](const MessageView& m) { save_message(f, m); })) {
+    f.setstate(std::ios::failbit);
+  }
+  for (const auto m : messages_) {
+    save_message(f, m);
+  }
+}
+
+void TextChannel::save(SnapshotWriter& w) const {
+  w.add_channel(getName(), "text", archived_);
+  if (source_ && !source_->save(w)) {
+    w.fail();
+  }
+  for (const auto m : messages_) {
+    save_message(w, m);
   }
 }
 
@@ -32,13 +545,9 @@ void VoiceChannel::save(fstream& f) {
   last_message_.save(f);
 }
 
-string time_to_string(const time_t& t) {
-  const int y_epoch{1900};
-  std::tm* now = std::localtime(&t);
-  std::stringstream ss;
-  ss << now->tm_mday << '/' << now->tm_mon + 1 << '/' << now->tm_year + y_epoch
-     << " - " << now->tm_hour << ':' << now->tm_min;
-  return ss.str();
+void VoiceChannel::save(SnapshotWriter& w) const {
+  w.add_channel(getName(), "voice");
+  last_message_.save(w);
 }
 
 }  // namespace concordo
@@ -0,0 +1,158 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "compression.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace concordo {
+
+namespace {
+
+constexpr size_t kMinMatch{4};
+constexpr size_t kMaxOffset{65535};
+constexpr size_t kLastLiterals{5};  // The last bytes are always literals,
+constexpr size_t kMatchLimit{12};   // and no match starts this close to the
+                                    // end, as in LZ4.
+constexpr int kHashBits{12};
+
+uint32_t read32(const char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+size_t hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - kHashBits);
+}
+
+// Lengths that don't fit in the 4 bits of the token go on in bytes of 255.
+void put_length(string& out, size_t n) {
+  for (; n >= 255; n -= 255) {
+    out += static_cast<char>(255);
+  }
+  out += static_cast<char>(n);
+}
+
+void put_sequence(string& out, string_view literals, size_t offset,
+                  size_t match) {
+  const size_t token{out.size()};
+  out += '\0';
+  unsigned nibbles{
+      static_cast<unsigned>(std::min<size_t>(literals.size(), 15) << 4)};
+  if (literals.size() >= 15) {
+    put_length(out, literals.size() - 15);
+  }
+  out += literals;
+  if (match > 0) {
+    out += static_cast<char>(offset & 0xff);
+    out += static_cast<char>(offset >> 8);
+    nibbles |= static_cast<unsigned>(std::min<size_t>(match - kMinMatch, 15));
+    if (match - kMinMatch >= 15) {
+      put_length(out, match - kMinMatch - 15);
+    }
+  }
+  out[token] = static_cast<char>(nibbles);
+}
+
+// Reads a length whose 4 bits in the token were all set.
+bool get_length(const unsigned char*& p, const unsigned char* end,
+                size_t& n) {
+  unsigned char b{255};
+  while (b == 255) {
+    if (p == end) {
+      return false;
+    }
+    b = *p++;
+    n += b;
+  }
+  return true;
+}
+
+}  // namespace
+
+string compress(string_view raw) {
+  string out;
+  out.reserve(raw.size() / 2 + 16);
+  // The last position seen of every hashed 4 bytes.
+  std::array<uint32_t, size_t{1} << kHashBits> seen{};
+  const char* const data{raw.data()};
+  size_t anchor{0};
+  size_t i{0};
+  const size_t limit{raw.size() > kMatchLimit ? raw.size() - kMatchLimit : 0};
+  while (i < limit) {
+    const uint32_t v{read32(data + i)};
+    uint32_t& slot{seen[hash(v)]};
+    const size_t candidate{slot};
+    slot = static_cast<uint32_t>(i);
+    if (candidate >= i || i - candidate > kMaxOffset ||
+        read32(data + candidate) != v) {
+      ++i;
+      continue;
+    }
+    size_t match{kMinMatch};
+    while (i + match < raw.size() - kLastLiterals &&
+           data[candidate + match] == data[i + match]) {
+      ++match;
+    }
+    put_sequence(out, raw.substr(anchor, i - anchor), i - candidate, match);
+    i += match;
+    anchor = i;
+  }
+  put_sequence(out, raw.substr(anchor), 0, 0);
+  return out;
+}
+
+bool decompress(string_view compressed, size_t raw_size, string& out) {
+  out.clear();
+  out.reserve(raw_size);
+  const auto* p{reinterpret_cast<const unsigned char*>(compressed.data())};
+  const auto* const end{p + compressed.size()};
+  while (p < end) {
+    const unsigned token{*p++};
+    size_t literals{token >> 4};
+    if (literals == 15 && !get_length(p, end, literals)) {
+      return false;
+    }
+    if (literals > static_cast<size_t>(end - p) ||
+        literals > raw_size - out.size()) {
+      return false;
+    }
+    out.append(reinterpret_cast<const char*>(p), literals);
+    p += literals;
+    if (p == end) {
+      break;
+    }
+    if (end - p < 2) {
+      return false;
+    }
+    const size_t offset{size_t{p[0]} | size_t{p[1]} << 8};
+    p += 2;
+    size_t match{token & 0xfU};
+    if (match == 15 && !get_length(p, end, match)) {
+      return false;
+    }
+    match += kMinMatch;
+    if (offset == 0 || offset > out.size() ||
+        match > raw_size - out.size()) {
+      return false;
+    }
+    // The buffer was reserved whole, so the bytes copied aren't moved. A copy
+    // that overlaps the bytes it writes repeats them, one at a time.
+    const size_t from{out.size() - offset};
+    if (offset >= match) {
+      out.append(out.data() + from, match);
+    } else {
+      for (size_t k{0}; k < match; ++k) {
+        out += out[from + k];
+      }
+    }
+  }
+  return out.size() == raw_size;
+}
+
+}  // namespace concordo
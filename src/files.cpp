@@ -0,0 +1,64 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "files.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+
+namespace concordo {
+
+namespace {
+
+bool sync(const string& path, int flags) {
+  const int fd{::open(path.c_str(), flags | O_CLOEXEC)};
+  if (fd < 0) {
+    return false;
+  }
+  const bool synced{fsync(fd) == 0};
+  return ::close(fd) == 0 && synced;
+}
+
+}  // namespace
+
+bool sync_file(const string& path) { return sync(path, O_RDONLY); }
+
+bool replace_file(const string& from, const string& to) {
+  if (!sync(from, O_RDONLY) || std::rename(from.c_str(), to.c_str()) != 0) {
+    return false;
+  }
+  const std::filesystem::path dir{std::filesystem::path{to}.parent_path()};
+  return sync(dir.empty() ? "." : dir.string(), O_RDONLY | O_DIRECTORY);
+}
+
+bool append_file(const string& path, string_view data) {
+  const int fd{::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                      0644)};
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st{};
+  const bool sized{fstat(fd, &st) == 0};
+  bool written{sized};
+  while (written && !data.empty()) {
+    const ssize_t n{::write(fd, data.data(), data.size())};
+    if (n > 0) {
+      data.remove_prefix(static_cast<size_t>(n));
+    } else if (errno != EINTR) {
+      written = false;
+    }
+  }
+  written = written && fdatasync(fd) == 0;
+  if (!written && sized && ftruncate(fd, st.st_size) == 0) {
+    fdatasync(fd);
+  }
+  return ::close(fd) == 0 && written;
+}
+
+}  // namespace concordo
@@ -0,0 +1,265 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#include "files.h"
+
+namespace concordo {
+
+using Clock = std::chrono::steady_clock;
+
+Journal::~Journal() {
+  if (writer_.joinable()) {
+    writer_.request_stop();
+    wake_.release();
+    writer_.join();
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void Journal::set_policy(const FlushPolicy& p) {
+  policy_ = p;
+  if (policy_.asynchronous() && !writer_.joinable()) {
+    writer_ = std::jthread{
+        [this](const std::stop_token& stop) { write_queued(stop); }};
+  }
+}
+
+bool Journal::open() {
+  fd_ = ::open(filename_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+               0644);
+  if (fd_ < 0) {
+    std::cerr << "Could not open '" << filename_ << "'!\n";
+  }
+  return fd_ >= 0;
+}
+
+bool Journal::write(string_view records) {
+  if (fd_ < 0 && !open()) {
+    return false;
+  }
+  while (!records.empty()) {
+    const ssize_t n{::write(fd_, records.data(), records.size())};
+    if (n > 0) {
+      records.remove_prefix(static_cast<size_t>(n));
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Journal::append(string_view record) {
+  ++records_;
+  if (!policy_.asynchronous()) {
+    // Writing the record before the command finishes makes it reach the OS,
+    // so a crash of the program can't lose it.
+    const std::lock_guard lock{mutex_};
+    string line{std::to_string(base_ + queued_.fetch_add(1) + 1)};
+    line += ' ';
+    line += record;
+    line += '\n';
+    if (!write(line)) {
+      failed_ = true;
+    }
+    return;
+  }
+  // The node belongs to the writer as soon as it's queued.
+  auto* const node{new Node{string{record}}};
+  Node* head{queue_.load(std::memory_order_relaxed)};
+  do {
+    node->next = head;
+  } while (!queue_.compare_exchange_weak(head, node, std::memory_order_release,
+                                         std::memory_order_relaxed));
+  const uint64_t n{queued_.fetch_add(1, std::memory_order_release) + 1};
+  // The writer waits for the first record to time the interval, and for
+  // every group of records.
+  if ((head == nullptr && policy_.interval.count() > 0) ||
+      (policy_.records > 0 && n % policy_.records == 0)) {
+    wake_.release();
+  }
+}
+
+bool Journal::sync() {
+  if (!policy_.asynchronous()) {
+    const std::lock_guard lock{mutex_};
+    return (fd_ < 0 || fdatasync(fd_) == 0) && !failed_;
+  }
+  const uint64_t target{queued_.load(std::memory_order_acquire)};
+  uint64_t synced{synced_.load(std::memory_order_acquire)};
+  if (synced < target) {
+    // The target only grows, so a concurrent sync never lowers it.
+    uint64_t requested{sync_target_.load()};
+    while (requested < target &&
+           !sync_target_.compare_exchange_weak(requested, target)) {
+    }
+    wake_.release();
+    while ((synced = synced_.load(std::memory_order_acquire)) < target) {
+      synced_.wait(synced);
+    }
+  }
+  return !failed_;
+}
+
+void Journal::write_queued(const std::stop_token& stop) {
+  string pending;    // The records taken, but not written yet.
+  uint64_t taken{0}; // The amount of records taken so far.
+  Clock::time_point deadline;
+  while (true) {
+    const bool stopping{stop.stop_requested()};
+    // While a sync waits for records the writer didn't take yet, it goes on
+    // taking them without waiting to be woken up.
+    const bool syncing{synced_.load() < sync_target_.load()};
+    if (!stopping && !syncing) {
+      if (pending.empty() || policy_.interval.count() == 0) {
+        wake_.acquire();
+      } else {
+        (void)wake_.try_acquire_until(deadline);
+      }
+      while (wake_.try_acquire()) {
+      }
+    }
+
+    // The queue is taken whole, and reversed into the order it was filled.
+    Node* node{queue_.exchange(nullptr, std::memory_order_acquire)};
+    Node* reversed{nullptr};
+    while (node != nullptr) {
+      Node* const next{node->next};
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+    if (reversed != nullptr && pending.empty()) {
+      deadline = Clock::now() + policy_.interval;
+    }
+    // The records are numbered as they're written, so in the same order.
+    while (reversed != nullptr) {
+      pending += std::to_string(base_ + ++taken);
+      pending += ' ';
+      pending += reversed->record;
+      pending += '\n';
+      delete std::exchange(reversed, reversed->next);
+    }
+
+    const bool due{
+        stopping || syncing || synced_.load() < sync_target_.load() ||
+        (policy_.records > 0 && queued_.load() - synced_.load() >=
+                                    policy_.records) ||
+        (policy_.interval.count() > 0 && Clock::now() >= deadline)};
+    if (due) {
+      if (!pending.empty()) {
+        const std::lock_guard lock{mutex_};
+        if (!write(pending) || fdatasync(fd_) != 0) {
+          failed_ = true;
+        }
+        pending.clear();
+      }
+      synced_.store(taken, std::memory_order_release);
+      synced_.notify_all();
+    }
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+// A crash may leave the records compacted in the journal, or the records
+// rotated in both files, so only the ones after the last one applied are
+// visited. Every record is counted, so the ones skipped are discarded by the
+// next compaction.
+size_t Journal::replay(uint64_t after,
+                       const std::function<void(string_view)>& visitor) {
+  size_t n{0};
+  string line;
+  for (const string& fn : {rotated_filename_, filename_}) {
+    fstream f{fn, std::ios::in};
+    while (getline(f, line)) {
+      if (line.empty()) {
+        continue;
+      }
+      ++n;
+      string_view record{line};
+      uint64_t number{};
+      const char* last{record.data() + record.size()};
+      if (auto [p, ec] = std::from_chars(record.data(), last, number);
+          ec == std::errc{} && p != last && *p == ' ') {
+        if (number <= after) {
+          continue;
+        }
+        after = number;
+        record.remove_prefix(static_cast<size_t>(p - record.data()) + 1);
+      }
+      visitor(record);
+    }
+  }
+  base_ = after;
+  records_ += n;
+  return n;
+}
+
+void Journal::clear() {
+  if (policy_.asynchronous()) {
+    sync();
+  }
+  const std::lock_guard lock{mutex_};
+  if (fd_ >= 0) {
+    ::close(std::exchange(fd_, -1));
+  }
+  const fstream f{filename_, std::ios::out | std::ios::trunc};
+  std::remove(rotated_filename_.c_str());
+  records_ = 0;
+}
+
+bool Journal::rotate() {
+  // The records set aside must outlive a crash until the compaction is
+  // durable, including the queued ones, as they were compacted too.
+  sync();
+  const std::lock_guard lock{mutex_};
+  if (fd_ >= 0) {
+    ::close(std::exchange(fd_, -1));
+  }
+  if (std::filesystem::exists(rotated_filename_)) {
+    // The last compaction failed, so its records are still needed. The ones
+    // joined to them are synced before the journal is truncated, so a crash
+    // can't lose them, and if it keeps them in both files, they're numbered,
+    // so they're replayed once.
+    string records;
+    {
+      fstream f{filename_, std::ios::in};
+      records.assign(std::istreambuf_iterator<char>{f}, {});
+    }
+    if (!records.empty() && !append_file(rotated_filename_, records)) {
+      std::cerr << "Could not open '" << rotated_filename_ << "'!\n";
+      return false;
+    }
+    const fstream truncated{filename_, std::ios::out | std::ios::trunc};
+  } else if (std::rename(filename_.c_str(), rotated_filename_.c_str()) != 0 &&
+             errno != ENOENT) {
+    std::cerr << "Could not open '" << rotated_filename_ << "'!\n";
+    return false;
+  }
+  records_ = 0;
+  return true;
+}
+
+void Journal::discard_rotated() {
+  const std::lock_guard lock{mutex_};
+  std::remove(rotated_filename_.c_str());
+}
+
+}  // namespace concordo
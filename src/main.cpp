@@ -2,13 +2,106 @@
 //
 // SPDX-License-Identifier: MIT
 
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "net.h"
 #include "system.h"
 
-int main() {
+int main(int argc, char* argv[]) {
   using System = concordo::System;
+  using StorageFormat = System::StorageFormat;
+
+  // Reads the value of an option, which is 0 if it's not a number.
+  const auto number = [](std::string_view s) {
+    size_t n{};
+    std::from_chars(s.data(), s.data() + s.size(), n);
+    return n;
+  };
 
   System sys;
-  sys.init();
+  StorageFormat format{StorageFormat::kText};
+  concordo::Journal::FlushPolicy policy;
+  bool convert{false};
+  bool batch{false};
+  std::string_view port;
+  std::string socket_path;
+  const auto args{std::span(argv, argv + argc).subspan(1)};
+  for (size_t i{0}; i < args.size(); ++i) {
+    const std::string_view arg{args[i]};
+    const bool has_value{i + 1 < args.size()};
+    if (arg == "--binary") {
+      format = StorageFormat::kBinary;
+    } else if (arg == "--sharded") {
+      format = StorageFormat::kSharded;
+    } else if (arg == "--convert") {
+      convert = true;
+    } else if (arg == "--batch") {
+      batch = true;
+    } else if (arg == "--compress") {
+      sys.set_compression(true);
+    } else if (arg == "--background-saves") {
+      sys.set_background_saves(true);
+    } else if (arg == "--load-threads" && has_value) {
+      sys.set_load_threads(number(args[++i]));
+    } else if (arg == "--flush-every" && has_value) {
+      policy.records = number(args[++i]);
+    } else if (arg == "--flush-interval" && has_value) {
+      policy.interval = std::chrono::milliseconds{
+          static_cast<std::chrono::milliseconds::rep>(number(args[++i]))};
+    } else if (arg == "--listen" && has_value) {
+      port = args[++i];
+    } else if (arg == "--socket" && has_value) {
+      socket_path = args[++i];
+    }
+  }
+
+  sys.set_flush_policy(policy);
+
+  // Converts the text files into another format instead of running, which is
+  // the binary snapshot unless another one is chosen.
+  if (convert) {
+    sys.set_format(StorageFormat::kText);
+    sys.convert(format == StorageFormat::kText ? StorageFormat::kBinary
+                                               : format);
+    return 0;
+  }
+  sys.set_format(format);
+  // Runs every command input in a single batch, saved when the input ends.
+  if (batch) {
+    sys.begin_batch();
+  }
+  if (port.empty() && socket_path.empty()) {
+    sys.init();
+    return 0;
+  }
+
+  // Serves many sessions through a socket instead of the standard input.
+  concordo::Listener listener{sys};
+  uint16_t n{};
+  if (!socket_path.empty()) {
+    if (!listener.listen_unix(socket_path)) {
+      std::cerr << "Could not listen on '" << socket_path << "'!\n";
+      return 1;
+    }
+    std::cout << "Listening on " << socket_path << std::endl;
+  } else {
+    const char* last{port.data() + port.size()};
+    if (auto [p, ec] = std::from_chars(port.data(), last, n);
+        ec != std::errc{} || p != last || !listener.listen_tcp(n)) {
+      std::cerr << "Could not listen on port " << port << "!\n";
+      return 1;
+    }
+    std::cout << "Listening on 127.0.0.1:" << listener.port() << std::endl;
+  }
+  sys.start();
+  listener.run();
+  sys.finish();
 
   return 0;
 }
@@ -0,0 +1,367 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "net.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <ostream>
+#include <span>
+#include <streambuf>
+#include <string_view>
+
+#include "tokenizer.h"
+
+namespace concordo {
+
+namespace {
+
+// A stream buffer that appends the output of a session to a string.
+class OutputBuffer : public std::streambuf {
+ public:
+  explicit OutputBuffer(string& s) : s_{s} {}
+
+ protected:
+  int overflow(int c) override {
+    if (c != traits_type::eof()) {
+      s_ += static_cast<char>(c);
+    }
+    return c;
+  }
+
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    s_.append(s, static_cast<size_t>(n));
+    return n;
+  }
+
+ private:
+  string& s_;
+};
+
+bool watch(int epoll_fd, int op, int fd, uint32_t events) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, op, fd, &ev) == 0;
+}
+
+}  // namespace
+
+/*! A struct that contains a client connected to the listener. */
+struct Listener::Connection : Subscriber {
+  Connection(int f, vector<int>& p) : fd{f}, pushed{p} {
+    session.output = &stream;
+    session.subscriber = this;
+  }
+
+  int fd;
+  string input;  /*!< The input received but not run yet. */
+  string output; /*!< The output of the commands run. */
+  size_t sent{}; /*!< How much of the output was already sent. */
+  OutputBuffer buffer{output};
+  std::ostream stream{&buffer};
+  System::Session session;
+  uint32_t events{EPOLLIN}; /*!< The events being watched. */
+  bool eof{false};     /*!< If the client won't send anything else. */
+  bool closing{false}; /*!< If it's closed once the output is sent. */
+  bool failed{false};  /*!< If it's closed right away. */
+  vector<int>& pushed; /*!< Where it's listed when a message is pushed. */
+  bool was_pushed{false}; /*!< If it's listed in pushed. */
+  size_t dropped{};       /*!< The messages dropped since the last one. */
+
+  [[nodiscard]] size_t pending() const { return output.size() - sent; }
+
+  bool deliver(string_view message) override {
+    if (pending() + message.size() > kMaxPushedOutput) {
+      ++dropped;
+      return false;
+    }
+    if (dropped > 0) {
+      stream << "(" << dropped << " messages were dropped)\n";
+      dropped = 0;
+    }
+    output += message;
+    if (!was_pushed) {
+      pushed.push_back(fd);
+      was_pushed = true;
+    }
+    return true;
+  }
+};
+
+Listener::Listener(System& sys) : sys_{sys} {}
+
+Listener::~Listener() {
+  for (const auto& [fd, c] : connections_) {
+    sys_.close_session(c->session);
+    ::close(fd);
+  }
+  for (const int fd : {listen_fd_, epoll_fd_, signal_fd_}) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+  if (!unix_path_.empty()) {
+    unlink(unix_path_.c_str());
+  }
+}
+
+bool Listener::listen_tcp(uint16_t port) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  const int on{1};
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr),
+              sizeof(addr)) == 0 &&
+         listen(listen_fd_, SOMAXCONN) == 0;
+}
+
+bool Listener::listen_unix(const string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  path.copy(addr.sun_path, path.size());
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  unlink(path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr),
+           sizeof(addr)) != 0) {
+    return false;
+  }
+  unix_path_ = path;
+  return listen(listen_fd_, SOMAXCONN) == 0;
+}
+
+uint16_t Listener::port() const {
+  sockaddr_in addr{};
+  socklen_t size{sizeof(addr)};
+  if (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &size) != 0 ||
+      addr.sin_family != AF_INET) {
+    return 0;
+  }
+  return ntohs(addr.sin_port);
+}
+
+bool Listener::run() {
+  // The signals are read from a descriptor, so the loop ends between events.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if (listen_fd_ < 0 || sigprocmask(SIG_BLOCK, &signals, nullptr) != 0) {
+    return false;
+  }
+  signal_fd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (signal_fd_ < 0 || epoll_fd_ < 0 ||
+      !watch(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, EPOLLIN) ||
+      !watch(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, EPOLLIN)) {
+    return false;
+  }
+
+  std::array<epoll_event, 256> events{};
+  bool running{true};
+  while (running) {
+    const int n{epoll_wait(epoll_fd_, events.data(),
+                           static_cast<int>(events.size()), -1)};
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    for (const epoll_event& e :
+         std::span(events.data(), static_cast<size_t>(n))) {
+      const int fd{e.data.fd};
+      if (fd == signal_fd_) {
+        running = false;
+        continue;
+      }
+      if (fd == listen_fd_) {
+        accept_all();
+        continue;
+      }
+      auto it{connections_.find(fd)};
+      if (it == connections_.end()) {
+        continue;
+      }
+      Connection& c{*it->second};
+      if ((e.events & EPOLLERR) != 0) {
+        c.failed = true;
+      } else if ((e.events & (EPOLLIN | EPOLLHUP)) != 0) {
+        receive(c);
+      }
+      // The output may have been holding back lines already received.
+      while (!c.failed) {
+        const size_t unread{c.input.size()};
+        process(c);
+        flush(c);
+        if (c.input.size() == unread || c.pending() >= kMaxPendingOutput) {
+          break;
+        }
+      }
+      if (!c.failed && !c.eof && c.input.size() >= kMaxLine &&
+          c.pending() < kMaxPendingOutput) {
+        c.failed = true;  // The line is too long.
+      }
+      if (c.failed || (c.closing && c.pending() == 0)) {
+        close(fd);
+      } else {
+        update_events(c);
+      }
+    }
+    flush_pushed();
+  }
+  return true;
+}
+
+void Listener::flush_pushed() {
+  for (const int fd : pushed_) {
+    auto it{connections_.find(fd)};
+    if (it == connections_.end()) {
+      continue;
+    }
+    Connection& c{*it->second};
+    c.was_pushed = false;
+    flush(c);
+    if (c.failed) {
+      close(fd);
+    } else {
+      update_events(c);
+    }
+  }
+  pushed_.clear();
+}
+
+void Listener::accept_all() {
+  const bool tcp{port() != 0};
+  while (true) {
+    const int fd{accept4(listen_fd_, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)};
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (tcp) {
+      // Every command is answered by a short write.
+      const int on{1};
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (!watch(epoll_fd_, EPOLL_CTL_ADD, fd, EPOLLIN)) {
+      ::close(fd);
+      continue;
+    }
+    connections_.emplace(fd, std::make_unique<Connection>(fd, pushed_));
+  }
+}
+
+void Listener::receive(Connection& c) {
+  std::array<char, 16384> buffer{};
+  while (!c.eof && c.input.size() < kMaxLine) {
+    const ssize_t n{recv(c.fd, buffer.data(), buffer.size(), 0)};
+    if (n > 0) {
+      c.input.append(buffer.data(), static_cast<size_t>(n));
+    } else if (n == 0) {
+      c.eof = true;
+    } else if (errno != EINTR) {
+      c.failed = errno != EAGAIN && errno != EWOULDBLOCK;
+      return;
+    }
+  }
+}
+
+void Listener::process(Connection& c) {
+  size_t start{0};
+  while (!c.closing && c.pending() < kMaxPendingOutput) {
+    size_t end{c.input.find('\n', start)};
+    if (end == string::npos) {
+      // The last line may not end with a newline.
+      if (!c.eof || start == c.input.size()) {
+        break;
+      }
+      end = c.input.size();
+    }
+    string_view line{c.input.data() + start, end - start};
+    if (line.ends_with('\r')) {
+      line.remove_suffix(1);
+    }
+    start = std::min(end + 1, c.input.size());
+    Tokenizer t{line};
+    const string_view cmd{t.next().value_or("")};
+    if (cmd == "quit") {
+      c.stream << "Leaving Concordo\n";
+      c.closing = true;
+    } else {
+      sys_.run(c.session, {cmd, t.raw()});
+    }
+  }
+  c.input.erase(0, start);
+  if (c.eof && c.input.empty()) {
+    c.closing = true;
+  }
+}
+
+void Listener::flush(Connection& c) {
+  while (c.pending() > 0) {
+    const ssize_t n{send(c.fd, c.output.data() + c.sent, c.pending(),
+                         MSG_NOSIGNAL)};
+    if (n >= 0) {
+      c.sent += static_cast<size_t>(n);
+    } else if (errno != EINTR) {
+      c.failed = errno != EAGAIN && errno != EWOULDBLOCK;
+      break;
+    }
+  }
+  if (c.pending() == 0) {
+    c.output.clear();
+    c.sent = 0;
+  }
+}
+
+void Listener::update_events(Connection& c) {
+  uint32_t events{0};
+  if (!c.eof && !c.closing && c.pending() < kMaxPendingOutput) {
+    events |= EPOLLIN;
+  }
+  if (c.pending() > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events != c.events && watch(epoll_fd_, EPOLL_CTL_MOD, c.fd, events)) {
+    c.events = events;
+  }
+}
+
+void Listener::close(int fd) {
+  if (auto it{connections_.find(fd)}; it != connections_.end()) {
+    sys_.close_session(it->second->session);
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  ::close(fd);
+  connections_.erase(fd);
+}
+
+}  // namespace concordo
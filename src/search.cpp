@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "search.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+namespace concordo {
+
+namespace ranges = std::ranges;
+
+void InvertedIndex::add(size_t position, string_view content) {
+  for_each_word(content, [&](string_view word) {
+    auto it{postings_.find(word)};
+    if (it == postings_.end()) {
+      it = postings_.emplace(word, vector<size_t>{}).first;
+    }
+    // A word repeated in the same message is indexed once.
+    if (it->second.empty() || it->second.back() != position) {
+      it->second.push_back(position);
+    }
+  });
+}
+
+span<const size_t> InvertedIndex::lookup(
+    string_view term, vector<vector<size_t>>& scratch) const {
+  if (!term.ends_with('*')) {
+    auto it{postings_.find(term)};
+    return it != postings_.end() ? span<const size_t>{it->second}
+                                 : span<const size_t>{};
+  }
+  // The postings of every word with the prefix are merged.
+  term.remove_suffix(1);
+  vector<size_t>& v{scratch.emplace_back()};
+  for (auto it{postings_.lower_bound(term)};
+       it != postings_.end() && it->first.starts_with(term); ++it) {
+    v.insert(v.end(), it->second.begin(), it->second.end());
+  }
+  ranges::sort(v);
+  v.erase(ranges::unique(v).begin(), v.end());
+  return v;
+}
+
+vector<size_t> InvertedIndex::search(const vector<string>& terms) const {
+  if (terms.empty()) {
+    return {};
+  }
+  vector<vector<size_t>> scratch;
+  scratch.reserve(terms.size());
+  vector<span<const size_t>> lists;
+  for (const auto& term : terms) {
+    lists.push_back(lookup(term, scratch));
+  }
+  // Starting from the rarest term keeps the intersections small.
+  ranges::sort(lists, {}, &span<const size_t>::size);
+  vector<size_t> found{lists.front().begin(), lists.front().end()};
+  for (size_t i{1}; i < lists.size() && !found.empty(); ++i) {
+    vector<size_t> both;
+    ranges::set_intersection(found, lists[i], std::back_inserter(both));
+    found = std::move(both);
+  }
+  return found;
+}
+
+void for_each_word(string_view text,
+                   const std::function<void(string_view)>& visitor) {
+  // Bytes of multibyte characters are taken as letters, so words that aren't
+  // written in ASCII are indexed too.
+  const auto is_letter = [](unsigned char c) {
+    return std::isalnum(c) != 0 || c >= 0x80;
+  };
+  string word;
+  for (const char ch : text) {
+    const auto c{static_cast<unsigned char>(ch)};
+    if (is_letter(c)) {
+      word += static_cast<char>(std::tolower(c));
+    } else if (!word.empty()) {
+      visitor(word);
+      word.clear();
+    }
+  }
+  if (!word.empty()) {
+    visitor(word);
+  }
+}
+
+}  // namespace concordo
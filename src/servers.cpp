@@ -19,6 +19,16 @@ void Server::save(fstream& f) {
   save_channels(f);
 }
 
+void Server::save(SnapshotWriter& w) const {
+  w.add_server(owner_id_, name_, description_, invite_code_);
+  for (const auto& id : members_ids_) {
+    w.add_member(id);
+  }
+  for (const auto& channel : channels_.values()) {
+    channel->save(w);
+  }
+}
+
 void Server::save_ids(fstream& f) {
   for (const auto& id : members_ids_) {
     f << id << '\n';
@@ -26,32 +36,58 @@ void Server::save_ids(fstream& f) {
 }
 
 void Server::save_channels(fstream& f) {
-  for (const auto& channel : channels_) {
+  for (const auto& channel : channels_.values()) {
     channel->save(f);
   }
 }
 
+void Server::create_channel(unique_ptr<Channel> c) {
+  auto& index{check_channel_type<TextChannel>(*c) ? text_channels_
+                                                  : voice_channels_};
+  const string name{c->getName()};
+  index.try_emplace(name, channels_.emplace(std::move(c)));
+  mark_dirty();
+}
+
 bool Server::check_channel(const ChannelDetails& cd) const {
-  return ranges::any_of(channels_, [&](const unique_ptr<Channel>& c) {
-    if (cd.type == "text") {
-      return c->check_name(cd.name) && check_channel_type<TextChannel>(*c);
-    }
-    return c->check_name(cd.name) && check_channel_type<VoiceChannel>(*c);
-  });
+  return channel_index(cd.type).contains(string_view{cd.name});
+}
+
+ChannelHandle Server::find_channel(string_view name) const {
+  auto text{text_channels_.find(name)};
+  auto voice{voice_channels_.find(name)};
+  if (text == text_channels_.end()) {
+    return voice != voice_channels_.end() ? voice->second : ChannelHandle{};
+  }
+  if (voice == voice_channels_.end()) {
+    return text->second;
+  }
+  // If both types share the name, the oldest channel is the one looked for.
+  // The channels are never removed, so their slots are in creation order.
+  return std::min(text->second, voice->second,
+                  [](ChannelHandle a, ChannelHandle b) {
+                    return a.index < b.index;
+                  });
+}
+
+ChannelHandle Server::find_channel(string_view name, string_view type) const {
+  const auto& index{channel_index(type)};
+  auto it{index.find(name)};
+  return it != index.end() ? it->second : ChannelHandle{};
 }
 
-void Server::list_text_channels() const {
-  for (const unique_ptr<Channel>& channel : channels_) {
+void Server::list_text_channels(ostream& out) const {
+  for (const unique_ptr<Channel>& channel : channels_.values()) {
     if (check_channel_type<TextChannel>(*channel)) {
-      channel->print();
+      channel->print(out);
     }
   }
 }
 
-void Server::list_voice_channels() const {
-  for (const unique_ptr<Channel>& channel : channels_) {
+void Server::list_voice_channels(ostream& out) const {
+  for (const unique_ptr<Channel>& channel : channels_.values()) {
     if (check_channel_type<VoiceChannel>(*channel)) {
-      channel->print();
+      channel->print(out);
     }
   }
 }
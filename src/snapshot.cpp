@@ -0,0 +1,378 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "compression.h"
+
+namespace concordo {
+
+namespace {
+
+constexpr uint64_t kAlignment{8};
+
+// The header of version 1 ends where the block table was added, and its
+// channel records had no blocks.
+constexpr size_t kHeaderSizeV1{offsetof(SnapshotHeader, blocks_offset)};
+
+struct ChannelRecordV1 {
+  StrRef name;
+  StrRef type;
+  uint32_t first_message;
+  uint32_t messages_count;
+};
+
+// The records of version 2 had no archived messages nor block dates.
+struct ChannelRecordV2 {
+  StrRef name;
+  StrRef type;
+  uint32_t first_message;
+  uint32_t messages_count;
+  uint32_t first_block;
+  uint32_t blocks_count;
+};
+
+struct BlockRecordV2 {
+  StrRef data;
+  uint32_t raw_size;
+  uint32_t messages_count;
+};
+
+// The size of a message in a block, besides its content.
+constexpr size_t kBlockMessageSize{sizeof(int64_t) + sizeof(int32_t) +
+                                   sizeof(uint32_t)};
+
+template <typename T>
+void put(string& block, T value) {
+  block.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(const char*& p) {
+  T value;
+  std::memcpy(&value, p, sizeof(value));
+  p += sizeof(value);
+  return value;
+}
+
+uint64_t align(uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+template <typename Record>
+void write_table(std::ofstream& f, const vector<Record>& v, uint64_t offset) {
+  f.seekp(static_cast<std::streamoff>(offset));
+  f.write(reinterpret_cast<const char*>(v.data()),
+          static_cast<std::streamsize>(v.size() * sizeof(Record)));
+}
+
+}  // namespace
+
+// SnapshotWriter methods.
+StrRef SnapshotWriter::add_string(string_view s) {
+  const StrRef r{static_cast<uint32_t>(strings_.size()),
+                 static_cast<uint32_t>(s.size())};
+  strings_ += s;
+  return r;
+}
+
+void SnapshotWriter::add_user(int id, string_view name, string_view address,
+                              string_view password) {
+  users_.push_back(
+      {id, add_string(name), add_string(address), add_string(password)});
+}
+
+void SnapshotWriter::add_server(int owner_id, string_view name,
+                                string_view description,
+                                string_view invite_code) {
+  servers_.push_back({owner_id, add_string(name), add_string(description),
+                      add_string(invite_code),
+                      static_cast<uint32_t>(members_.size()), 0,
+                      static_cast<uint32_t>(channels_.size()), 0});
+}
+
+void SnapshotWriter::add_member(int id) {
+  members_.push_back(id);
+  ++servers_.back().members_count;
+}
+
+void SnapshotWriter::add_channel(string_view name, string_view type,
+                                 size_t archived) {
+  flush_block();
+  channels_.push_back({add_string(name), add_string(type),
+                       static_cast<uint32_t>(messages_.size()), 0,
+                       static_cast<uint32_t>(blocks_.size()), 0, archived});
+  ++servers_.back().channels_count;
+  compressing_ = compress_ && type == "text";
+}
+
+void SnapshotWriter::add_message(time_t date_time, int sender_id,
+                                 string_view content) {
+  if (!compressing_) {
+    messages_.push_back({date_time, sender_id, add_string(content)});
+    ++channels_.back().messages_count;
+    return;
+  }
+  if (block_messages_ == 0) {
+    block_first_date_ = date_time;
+  }
+  put(block_, int64_t{date_time});
+  put(block_, int32_t{sender_id});
+  put(block_, static_cast<uint32_t>(content.size()));
+  block_ += content;
+  ++block_messages_;
+  if (block_.size() >= kBlockSize) {
+    flush_block();
+  }
+}
+
+void SnapshotWriter::add_block(const BlockRecord& b, string_view data) {
+  flush_block();
+  blocks_.push_back(
+      {add_string(data), b.raw_size, b.messages_count, b.first_date});
+  ++channels_.back().blocks_count;
+}
+
+void SnapshotWriter::flush_block() {
+  if (block_messages_ == 0) {
+    return;
+  }
+  if (block_.size() > kMaxSize) {
+    failed_ = true;
+  }
+  blocks_.push_back({add_string(compress(block_)),
+                     static_cast<uint32_t>(block_.size()), block_messages_,
+                     block_first_date_});
+  ++channels_.back().blocks_count;
+  block_.clear();
+  block_messages_ = 0;
+}
+
+// Every offset and count in the records is bounded by the size of its
+// table, so if the tables fit, so do they, and they didn't wrap when added.
+bool SnapshotWriter::write(const string& filename, int last_id) {
+  flush_block();
+  if (failed_ || strings_.size() > kMaxSize || members_.size() > kMaxSize ||
+      channels_.size() > kMaxSize || messages_.size() > kMaxSize ||
+      blocks_.size() > kMaxSize) {
+    return false;
+  }
+  SnapshotHeader h{};
+  std::ranges::copy(kSnapshotMagic, h.magic);
+  h.version = kSnapshotVersion;
+  h.last_id = last_id;
+  h.users_offset = align(sizeof(SnapshotHeader));
+  h.users_count = users_.size();
+  h.servers_offset = align(h.users_offset + users_.size() * sizeof(UserRecord));
+  h.servers_count = servers_.size();
+  h.members_offset =
+      align(h.servers_offset + servers_.size() * sizeof(ServerRecord));
+  h.members_count = members_.size();
+  h.channels_offset =
+      align(h.members_offset + members_.size() * sizeof(int32_t));
+  h.channels_count = channels_.size();
+  h.messages_offset =
+      align(h.channels_offset + channels_.size() * sizeof(ChannelRecord));
+  h.messages_count = messages_.size();
+  h.blocks_offset =
+      align(h.messages_offset + messages_.size() * sizeof(MessageRecord));
+  h.blocks_count = blocks_.size();
+  h.strings_offset =
+      align(h.blocks_offset + blocks_.size() * sizeof(BlockRecord));
+  h.strings_size = strings_.size();
+
+  std::ofstream f{filename, std::ios::binary | std::ios::trunc};
+  if (!f) {
+    return false;
+  }
+  f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  write_table(f, users_, h.users_offset);
+  write_table(f, servers_, h.servers_offset);
+  write_table(f, members_, h.members_offset);
+  write_table(f, channels_, h.channels_offset);
+  write_table(f, messages_, h.messages_offset);
+  write_table(f, blocks_, h.blocks_offset);
+  f.seekp(static_cast<std::streamoff>(h.strings_offset));
+  f.write(strings_.data(), static_cast<std::streamsize>(strings_.size()));
+  f.close();
+  return static_cast<bool>(f);
+}
+
+// Snapshot methods.
+Snapshot::~Snapshot() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+bool Snapshot::open(const string& filename) {
+  const int fd{::open(filename.c_str(), O_RDONLY)};
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < kHeaderSizeV1) {
+    close(fd);
+    return false;
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void* p{mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0)};
+  close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  data_ = p;
+  SnapshotHeader& h{header_};
+  std::memcpy(&h, data_, kHeaderSizeV1);
+  const bool v1{h.version == 1};
+  const bool v2{h.version == 2};
+  if ((v2 || h.version == kSnapshotVersion) &&
+      size_ >= sizeof(SnapshotHeader)) {
+    std::memcpy(&h, data_, sizeof(SnapshotHeader));
+  } else if (!v1) {
+    return false;
+  }
+  const size_t channel_size{v1   ? sizeof(ChannelRecordV1)
+                            : v2 ? sizeof(ChannelRecordV2)
+                                 : sizeof(ChannelRecord)};
+  const bool valid{
+      string_view(h.magic, sizeof(h.magic)) == kSnapshotMagic &&
+      check_table(h.users_offset, h.users_count, sizeof(UserRecord)) &&
+      check_table(h.servers_offset, h.servers_count, sizeof(ServerRecord)) &&
+      check_table(h.members_offset, h.members_count, sizeof(int32_t)) &&
+      check_table(h.channels_offset, h.channels_count, channel_size) &&
+      check_table(h.messages_offset, h.messages_count,
+                  sizeof(MessageRecord)) &&
+      check_table(h.blocks_offset, h.blocks_count,
+                  v2 ? sizeof(BlockRecordV2) : sizeof(BlockRecord)) &&
+      check_table(h.strings_offset, h.strings_size, 1)};
+  if (valid && v1) {
+    for (const auto& c :
+         table<ChannelRecordV1>(h.channels_offset, 0, h.channels_count)) {
+      channels_.push_back(
+          {c.name, c.type, c.first_message, c.messages_count, 0, 0, 0});
+    }
+  }
+  if (valid && v2) {
+    for (const auto& c :
+         table<ChannelRecordV2>(h.channels_offset, 0, h.channels_count)) {
+      channels_.push_back({c.name, c.type, c.first_message, c.messages_count,
+                           c.first_block, c.blocks_count, 0});
+    }
+    for (const auto& b :
+         table<BlockRecordV2>(h.blocks_offset, 0, h.blocks_count)) {
+      blocks_.push_back({b.data, b.raw_size, b.messages_count,
+                         std::numeric_limits<int64_t>::min()});
+    }
+  }
+  return valid;
+}
+
+bool Snapshot::check_table(uint64_t offset, uint64_t count,
+                           size_t record_size) const {
+  return offset % kAlignment == 0 && offset <= size_ &&
+         count <= (size_ - offset) / record_size;
+}
+
+template <typename Record>
+span<const Record> Snapshot::table(uint64_t offset, uint64_t first,
+                                   uint64_t count) const {
+  const auto* base{reinterpret_cast<const Record*>(
+      static_cast<const char*>(data_) + offset)};
+  return {base + first, count};
+}
+
+span<const UserRecord> Snapshot::users() const {
+  return table<UserRecord>(header().users_offset, 0, header().users_count);
+}
+
+span<const ServerRecord> Snapshot::servers() const {
+  return table<ServerRecord>(header().servers_offset, 0,
+                             header().servers_count);
+}
+
+span<const int32_t> Snapshot::members(const ServerRecord& s) const {
+  if (uint64_t{s.first_member} + s.members_count > header().members_count) {
+    return {};
+  }
+  return table<int32_t>(header().members_offset, s.first_member,
+                        s.members_count);
+}
+
+span<const ChannelRecord> Snapshot::channels(const ServerRecord& s) const {
+  if (uint64_t{s.first_channel} + s.channels_count >
+      header().channels_count) {
+    return {};
+  }
+  if (header().version < kSnapshotVersion) {
+    return span{channels_}.subspan(s.first_channel, s.channels_count);
+  }
+  return table<ChannelRecord>(header().channels_offset, s.first_channel,
+                              s.channels_count);
+}
+
+span<const MessageRecord> Snapshot::messages(const ChannelRecord& c) const {
+  if (uint64_t{c.first_message} + c.messages_count >
+      header().messages_count) {
+    return {};
+  }
+  return table<MessageRecord>(header().messages_offset, c.first_message,
+                              c.messages_count);
+}
+
+span<const BlockRecord> Snapshot::blocks(const ChannelRecord& c) const {
+  if (uint64_t{c.first_block} + c.blocks_count > header().blocks_count) {
+    return {};
+  }
+  if (header().version == 2) {
+    return span{blocks_}.subspan(c.first_block, c.blocks_count);
+  }
+  return table<BlockRecord>(header().blocks_offset, c.first_block,
+                            c.blocks_count);
+}
+
+string_view Snapshot::str(StrRef r) const {
+  if (uint64_t{r.offset} + r.length > header().strings_size) {
+    return {};
+  }
+  return {static_cast<const char*>(data_) + header().strings_offset + r.offset,
+          r.length};
+}
+
+void Snapshot::for_each_message(
+    const BlockRecord& b,
+    const std::function<void(time_t, int, string_view)>& visitor) const {
+  string raw;
+  if (!decompress(str(b.data), b.raw_size, raw)) {
+    return;
+  }
+  const char* p{raw.data()};
+  const char* const end{raw.data() + raw.size()};
+  for (uint32_t i{0};
+       i < b.messages_count && static_cast<size_t>(end - p) >= kBlockMessageSize;
+       ++i) {
+    const auto date_time{get<int64_t>(p)};
+    const auto sender_id{get<int32_t>(p)};
+    const auto length{get<uint32_t>(p)};
+    if (length > static_cast<size_t>(end - p)) {
+      return;
+    }
+    visitor(static_cast<time_t>(date_time), sender_id, {p, length});
+    p += length;
+  }
+}
+
+}  // namespace concordo
@@ -7,502 +7,1613 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <functional>
-#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <optional>
 #include <ranges>
+#include <shared_mutex>
 #include <string>
-#include <unordered_set>
 #include <utility>
 
 #include "channels.h"
+#include "files.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
 
 namespace concordo {
 
 using std::array, std::cin, std::cout, std::getline, std::unique_ptr,
-    std::fstream, std::stoi, std::make_unique;
+    std::fstream, std::stoi, std::stoll, std::make_unique;
 namespace ranges = std::ranges;
-namespace views = std::views;
 using enum System::SystemState;
 
+thread_local System::Context* System::context_{nullptr};
+
+namespace {
+
+// The bit of a state in the mask of the states a command is allowed in.
+constexpr unsigned state_bit(System::SystemState state) {
+  return 1U << static_cast<unsigned>(state);
+}
+
+constexpr unsigned kAnyState{state_bit(kGuest) | state_bit(kLogged_In) |
+                             state_bit(kJoinedServer) |
+                             state_bit(kJoinedChannel)};
+
+// FNV-1a, seeded so that it can be made perfect for the command table.
+constexpr uint32_t command_hash(string_view name, uint32_t seed) {
+  uint32_t h{2166136261U ^ seed};
+  for (const char c : name) {
+    h = (h ^ static_cast<unsigned char>(c)) * 16777619U;
+  }
+  return h;
+}
+
+constexpr size_t kCommandSlots{64};
+
+// The slots of the commands, by hash, holding their position plus one.
+struct CommandSlots {
+  uint32_t seed{};
+  array<uint8_t, kCommandSlots> slots{};
+};
+
+// Finds the first seed in which no two commands share a slot.
+template <size_t N>
+constexpr std::optional<CommandSlots> make_command_slots(
+    const array<CommandSpec, N>& commands) {
+  static_assert(N < std::numeric_limits<uint8_t>::max());
+  for (uint32_t seed{0}; seed < 4096; ++seed) {
+    CommandSlots t{seed, {}};
+    bool perfect{true};
+    for (size_t i{0}; i < N && perfect; ++i) {
+      auto& slot{t.slots[command_hash(commands[i].name, seed) % kCommandSlots]};
+      perfect = slot == 0;
+      slot = static_cast<uint8_t>(i + 1);
+    }
+    if (perfect) {
+      return t;
+    }
+  }
+  return std::nullopt;
+}
+
+// An arena for the details of the user or server being loaded, which is
+// rewound once they are built into the system.
+class LoadArena {
+ public:
+  LoadArena()
+      : buffer_{std::make_unique_for_overwrite<std::byte[]>(kSize)},
+        resource_{buffer_.get(), kSize} {}
+
+  DetailsAllocator allocator() { return &resource_; }
+
+  // Anything bigger than the buffer is released too.
+  void rewind() { resource_.release(); }
+
+ private:
+  static constexpr size_t kSize{64 * 1024};
+  unique_ptr<std::byte[]> buffer_;
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+// Reads a line into a buffer shared by every line, as getline is only fast
+// for std::string.
+string_view read_line(std::istream& f) {
+  thread_local string line;
+  getline(f, line);
+  return line;
+}
+
+int read_number(std::istream& f) {
+  const string_view line{read_line(f)};
+  int n{};
+  std::from_chars(line.data(), line.data() + line.size(), n);
+  return n;
+}
+
+void add_channels(Server& s, std::span<ChannelDetails> v) {
+  for (auto& cd : v) {
+    if (cd.type == "text") {
+      s.create_channel(make_unique<TextChannel>(std::move(cd)));
+    } else if (cd.type == "voice") {
+      s.create_channel(make_unique<VoiceChannel>(std::move(cd)));
+    }
+  }
+}
+
+// Sets the policy of a server, or of one of its text channels, written as in
+// the set-retention command. An empty policy removes the one of the channel.
+void assign_retention(Server& s, string_view channel, string_view policy) {
+  std::optional<RetentionPolicy> p;
+  if (!Tokenizer{policy}.empty()) {
+    p = parse_retention(policy);
+    if (!p) {
+      return;
+    }
+  }
+  if (channel.empty()) {
+    s.set_retention(p.value_or(RetentionPolicy{}));
+  } else if (auto* c{dynamic_cast<TextChannel*>(
+                 s.get_channel(s.find_channel(channel, "text")))};
+             c != nullptr) {
+    c->set_retention(p);
+  }
+}
+
+// The servers are named by number, as their names may have any character.
+string shard_filename(int shard) {
+  return "servers/" + std::to_string(shard) + ".txt";
+}
+
+}  // namespace
+
 // Main system loop.
 void System::init() {
   string cmd_line;
-  string cmd;
-  string args;
-  load();
+  start();
   while (getline(cin, cmd_line)) {
-    load();
-    cmd = parse_cmd(cmd_line);
+    Tokenizer t{cmd_line};
+    const string_view cmd{t.next().value_or("")};
     if (cmd == "quit") {
       cout << "Leaving Concordo\n";
       break;
     }
-    if (check_args(cmd_line)) {
-      args = parse_args(cmd_line);
-    }
-    this->run({cmd, args});
+    this->run({cmd, t.raw()});
   }
+  finish();
+}
+
+void System::start() {
+  const std::unique_lock lock{state_mutex_};
+  load();
+  replay_journal();
+}
+
+void System::finish() {
+  const std::unique_lock lock{state_mutex_};
+  if (console_.batch.started) {
+    commit_batch();
+  }
+  if (journal_.size() > 0) {
+    compact();
+  }
+  wait_for_save();
 }
 
 void System::run(const CommandLine& cl) {
-  // Disconnect can be run at any state that isn't guest.
-  if (cl.command == "disconnect") {
-    disconnect();
-  } else if (check_all_commands(cl.command)) {
-    switch (current_state_) {
-      case kGuest:
-        run_guest_cmd(cl);
-        break;
-      case kLogged_In:
-        run_logged_cmd(cl);
-        break;
-      case kJoinedServer:
-        run_server_cmd(cl);
-        break;
-      case kJoinedChannel:
-        run_channel_cmd(cl);
-        break;
-    }
-    if (check_command(save_required_commands_, cl.command)) {
-      save();
+  Context* const previous{std::exchange(context_, &console_)};
+  execute(cl);
+  context_ = previous;
+}
+
+void System::run(Session& s, const CommandLine& cl) {
+  Context c;
+  attach(s, c);
+  Context* const previous{std::exchange(context_, &c)};
+  execute(cl);
+  context_ = previous;
+  detach(s, c);
+}
+
+void System::execute(const CommandLine& cl) {
+  const CommandSpec* c{find_command(cl.command)};
+  if (c == nullptr) {
+    output() << "Invalid command\n";
+  } else if ((c->states & state_bit(ctx().state)) == 0) {
+    if (ctx().state == kGuest) {
+      output() << "You have to login to run that command\n";
+    } else {
+      print_unable(output());
     }
   } else {
-    cout << "Invalid command\n";
+    if (ctx().batch.started) {
+      ++ctx().batch.commands;
+    }
+    {
+      // The batches save the whole system, so they run alone.
+      std::shared_lock shared{state_mutex_, std::defer_lock};
+      std::unique_lock exclusive{state_mutex_, std::defer_lock};
+      if (c->exclusive) {
+        exclusive.lock();
+      } else {
+        shared.lock();
+      }
+      c->handler(*this, cl.arguments);
+    }
+    if (c->persists) {
+      maybe_compact();
+    }
   }
 }
 
-void System::run_guest_cmd(const CommandLine& cl) {
-  if (check_command(guest_commands_, cl.command)) {
-    if (cl.command == "create-user") {
-      create_user(cl.arguments);
-    } else {
-      user_login(cl.arguments);
+// A message may still be delivered to the session by a publish() that found
+// it before it unsubscribed, so it ends once they're all delivered.
+void System::close_session(Session& s) {
+  subscribe(s, nullptr);
+  if (s.batch.started) {
+    const std::unique_lock lock{state_mutex_};
+    end_batch(s.batch);
+  }
+  const std::lock_guard lock{deliveries_mutex_};
+}
+
+void System::attach(Session& s, Context& c) {
+  c.session = &s;
+  c.output = s.output;
+  c.state = s.state;
+  c.batch = s.batch;
+  if (c.state > kGuest) {
+    // The users are only removed when the system is reloaded.
+    const std::shared_lock lock{users_mutex_};
+    c.user = users_.get(s.user);
+    c.user_handle = s.user;
+    if (c.user == nullptr) {
+      c.state = kGuest;
     }
-  } else {
-    cout << "You have to login to run that command\n";
-  }
-}
-
-void System::run_logged_cmd(const CommandLine& cl) {
-  if (check_command(logged_commands_, cl.command)) {
-    if (cl.command == "create-server") {
-      create_server(cl.arguments);
-    } else if (cl.command == "set-server-desc") {
-      change_description(parse_details(cl.arguments, 0));
-    } else if (cl.command == "set-server-invite-code") {
-      change_invite(parse_details(cl.arguments, 1));
-    } else if (cl.command == "list-servers") {
-      list_servers();
-    } else if (cl.command == "remove-server") {
-      remove_server(cl.arguments);
+  }
+  if (c.state >= kJoinedServer) {
+    // Another session may have removed the server.
+    const std::shared_lock lock{servers_mutex_};
+    if (const auto* server{servers_.get(s.server)}; server != nullptr) {
+      c.server = *server;
+      c.server_handle = s.server;
     } else {
-      enter_server(parse_details(cl.arguments, 2));
+      c.state = kLogged_In;
+    }
+  }
+  if (c.state == kJoinedChannel) {
+    const std::shared_lock lock{c.server->mutex()};
+    c.channel = c.server->get_channel(s.channel);
+    c.channel_handle = s.channel;
+    if (c.channel == nullptr) {
+      c.state = kJoinedServer;
     }
-  } else {
-    print_unable();
   }
 }
 
-void System::run_server_cmd(const CommandLine& cl) {
-  if (check_command(server_commands_, cl.command)) {
-    if (cl.command == "leave-server") {
-      leave_server();
-    } else if (cl.command == "list-participants") {
-      list_participants();
-    } else if (cl.command == "list-channels") {
-      list_channels();
-    } else if (cl.command == "create-channel") {
-      create_channel(cl.arguments);
-    } else if (cl.command == "enter-channel") {
-      enter_channel(cl.arguments);
-    } else if (cl.command == "leave-channel") {
-      leave_channel();
-    }
-  } else {
-    print_unable();
+void System::detach(Session& s, const Context& c) {
+  s.state = c.state;
+  s.batch = c.batch;
+  s.user = c.state > kGuest ? c.user_handle : UserHandle{};
+  s.server = c.state >= kJoinedServer ? c.server_handle : ServerHandle{};
+  s.channel = c.state == kJoinedChannel ? c.channel_handle : ChannelHandle{};
+  if (s.subscriber != nullptr) {
+    subscribe(s, c.state == kJoinedChannel ? c.channel : nullptr);
   }
 }
 
-void System::run_channel_cmd(const CommandLine& cl) {
-  if (check_command(channel_commands_, cl.command)) {
-    if (cl.command == "send-message") {
-      send_message(cl.arguments);
-    } else {
-      list_messages();
+void System::subscribe(Session& s, const Channel* c) {
+  const std::lock_guard lock{subscribers_mutex_};
+  if (s.subscribed == c) {
+    return;
+  }
+  if (auto it{subscribers_.find(s.subscribed)}; it != subscribers_.end()) {
+    std::erase(it->second, &s);
+    if (it->second.empty()) {
+      subscribers_.erase(it);
     }
-  } else {
-    print_unable();
+  }
+  if (c != nullptr) {
+    subscribers_[c].push_back(&s);
+  }
+  s.subscribed = c;
+}
+
+// The message is rendered once for every subscriber, before anything is
+// locked, and the subscribers are only locked while they're copied, so the
+// sessions entering and leaving channels don't wait for the deliveries.
+void System::publish(const Channel& c, const MessageView& m) {
+  string line;
+  render_message(line, m);
+  Session* const sender{ctx().session};
+  vector<Subscriber*> targets;
+  const std::lock_guard deliveries{deliveries_mutex_};
+  {
+    const std::lock_guard lock{subscribers_mutex_};
+    if (const auto it{subscribers_.find(&c)}; it != subscribers_.end()) {
+      targets.reserve(it->second.size());
+      for (Session* s : it->second) {
+        if (s != sender) {
+          targets.push_back(s->subscriber);
+        }
+      }
+    }
+  }
+  for (Subscriber* s : targets) {
+    s->deliver(line);
   }
 }
 
-bool System::check_all_commands(string_view cmd) const {
-  const array<unordered_set<string>, 4> all_cmds{
-      guest_commands_, logged_commands_, server_commands_, channel_commands_};
-  return ranges::any_of(all_cmds, [=](const unordered_set<string>& s) {
-    return s.contains(string(cmd));
-  });
+const CommandSpec* System::find_command(string_view name) {
+  constexpr unsigned kGuestCmd{state_bit(kGuest)};
+  constexpr unsigned kLoggedCmd{state_bit(kLogged_In)};
+  constexpr unsigned kServerCmd{state_bit(kJoinedServer)};
+  constexpr unsigned kChannelCmd{state_bit(kJoinedChannel)};
+  // Batches, sync and disconnect can be run at any state (but disconnect does
+  // nothing to guests).
+  static constexpr array<CommandSpec, 23> kCommands{{
+      {"create-user", [](System& s, string_view a) { s.create_user(a); },
+       kGuestCmd, true, false},
+      {"login", [](System& s, string_view a) { s.user_login(a); }, kGuestCmd,
+       false, false},
+      {"disconnect", [](System& s, string_view) { s.disconnect(); }, kAnyState,
+       false, false},
+      {"begin-batch", [](System& s, string_view) { s.begin_batch(); },
+       kAnyState, false, true},
+      {"commit-batch", [](System& s, string_view) { s.commit_batch(); },
+       kAnyState, false, true},
+      {"sync", [](System& s, string_view) { s.sync(); }, kAnyState, false,
+       false},
+      {"create-server",
+       [](System& s, string_view a) { s.create_server(a); },
+       kLoggedCmd, true, false},
+      {"set-server-desc",
+       [](System& s, string_view a) {
+         s.change_description(parse_details(a, 0));
+       },
+       kLoggedCmd, true, false},
+      {"set-server-invite-code",
+       [](System& s, string_view a) { s.change_invite(parse_details(a, 1)); },
+       kLoggedCmd, true, false},
+      {"list-servers", [](System& s, string_view) { s.list_servers(); },
+       kLoggedCmd, false, false},
+      {"remove-server",
+       [](System& s, string_view a) { s.remove_server(a); },
+       kLoggedCmd, true, false},
+      {"enter-server",
+       [](System& s, string_view a) { s.enter_server(parse_details(a, 2)); },
+       kLoggedCmd, false, false},
+      {"leave-server", [](System& s, string_view) { s.leave_server(); },
+       kServerCmd | kChannelCmd, false, false},
+      {"list-participants",
+       [](System& s, string_view) { s.list_participants(); }, kServerCmd,
+       false, false},
+      {"list-channels", [](System& s, string_view) { s.list_channels(); },
+       kServerCmd, false, false},
+      {"create-channel", [](System& s, string_view a) { s.create_channel(a); },
+       kServerCmd, true, false},
+      {"enter-channel",
+       [](System& s, string_view a) { s.enter_channel(a); },
+       kServerCmd, false, false},
+      {"leave-channel", [](System& s, string_view) { s.leave_channel(); },
+       kServerCmd | kChannelCmd, false, false},
+      {"search-messages",
+       [](System& s, string_view a) { s.search_messages(a); },
+       kServerCmd | kChannelCmd, false, false},
+      {"send-message", [](System& s, string_view a) { s.send_message(a); },
+       kChannelCmd, true, false},
+      {"list-messages", [](System& s, string_view a) { s.list_messages(a); },
+       kChannelCmd, false, false},
+      {"set-retention", [](System& s, string_view a) { s.set_retention(a); },
+       kServerCmd | kChannelCmd, true, false},
+      {"list-archived-messages",
+       [](System& s, string_view a) { s.list_archived_messages(a); },
+       kChannelCmd, false, false},
+  }};
+  static constexpr auto kSlots{make_command_slots(kCommands)};
+  static_assert(kSlots.has_value(), "No perfect hash for the command table");
+
+  const uint8_t slot{
+      kSlots->slots[command_hash(name, kSlots->seed) % kCommandSlots]};
+  if (slot == 0 || kCommands[slot - 1].name != name) {
+    return nullptr;
+  }
+  return &kCommands[slot - 1];
 }
 
 // User related commands.
 bool System::check_credentials(string_view cred) const {
   const UserCredentials c = parse_credentials(cred);
-  return ranges::any_of(users_list_, [&](const User& u) {
-    return check_address(u, c.address) && check_password(u, c.password);
-  });
+  const std::shared_lock lock{users_mutex_};
+  auto it{users_by_address_.find(string_view{c.address})};
+  return it != users_by_address_.end() &&
+         check_password(*users_.get(it->second), c.password);
 }
 
-auto System::find_user(int id) const {
-  return ranges::find_if(users_list_,
-                         [=](const User& u) { return check_id(u, id); });
+const User* System::find_user(int id) const {
+  const std::shared_lock lock{users_mutex_};
+  auto it{users_by_id_.find(id)};
+  return it != users_by_id_.end() ? users_.get(it->second) : nullptr;
 }
 
-auto System::find_user(string_view address) {
-  return ranges::find_if(
-      users_list_, [=](const User& u) { return check_address(u, address); });
+User* System::find_user(string_view address) {
+  const std::shared_lock lock{users_mutex_};
+  auto it{users_by_address_.find(address)};
+  return it != users_by_address_.end() ? users_.get(it->second) : nullptr;
 }
 
-string System::get_user_name(int id) const { return find_user(id)->getName(); }
+string_view System::get_user_name(int id) const {
+  const auto i{static_cast<size_t>(id)};
+  const std::shared_lock lock{users_mutex_};
+  return i < user_names_.size() ? string_view{user_names_[i]} : string_view{};
+}
 
-void System::emplace_user(const UserCredentials& c) {
+System::UserHandle System::emplace_user(const UserCredentials& c) {
   ++last_id_;
-  users_list_.emplace_back(last_id_, c);
+  const UserHandle h{users_.emplace(last_id_, c)};
+  users_by_id_.emplace(last_id_, h);
+  users_by_address_.emplace(c.address, h);
+  // Ids only grow, so the names are only ever appended (see user_names_).
+  user_names_.resize(static_cast<size_t>(last_id_));
+  user_names_.emplace_back(c.name);
+  return h;
 }
 
 void System::create_user(string_view args) {
   const UserCredentials c = parse_new_credentials(args);
-  if (!any_of<const vector<User>&>(users_list_, c.address, check_address)) {
+  std::unique_lock lock{users_mutex_};
+  if (!users_by_address_.contains(string_view{c.address})) {
     emplace_user(c);
-    cout << "User created\n";
+    record({"create-user", std::to_string(last_id_), c.address, c.password,
+            c.name});
+    lock.unlock();
+    output() << "User created\n";
   } else {
-    cout << "User already exist!\n";
+    lock.unlock();
+    output() << "User already exist!\n";
   }
 }
 
 void System::user_login(string_view cred) {
   const string a{(parse_credentials(cred)).address};
   if (check_credentials(cred)) {
-    current_user_ = &*find_user(a);
-    current_state_ = kLogged_In;
-    cout << "Logged-in as " << a << '\n';
+    Context& c{ctx()};
+    {
+      const std::shared_lock lock{users_mutex_};
+      c.user_handle = users_by_address_.find(a)->second;
+      c.user = users_.get(c.user_handle);
+    }
+    c.state = kLogged_In;
+    output() << "Logged-in as " << a << '\n';
   } else {
-    cout << "User or password invalid!\n";
+    output() << "User or password invalid!\n";
   }
 }
 
 void System::disconnect() {
-  if (current_state_ > kGuest) {
-    current_state_ = kGuest;
-    cout << "Disconnecting user " << *current_user_ << '\n';
-    current_server_ = nullptr;
-    current_user_ = nullptr;
+  Context& c{ctx()};
+  if (c.state > kGuest) {
+    c.state = kGuest;
+    output() << "Disconnecting user " << *c.user << '\n';
+    c.server = nullptr;
+    c.channel = nullptr;
+    c.user = nullptr;
   } else {
-    cout << "Not connected\n";
+    output() << "Not connected\n";
   }
 }
 
 // Server related commands.
-auto System::find_server(string_view name) {
-  return find_if(servers_list_.begin(), servers_list_.end(),
-                 [=](const Server& s) { return check_name(s, name); });
+shared_ptr<Server> System::find_server(string_view name) const {
+  const std::shared_lock lock{servers_mutex_};
+  auto it{servers_by_name_.find(name)};
+  return it != servers_by_name_.end() ? *servers_.get(it->second) : nullptr;
+}
+
+void System::emplace_server(int owner_id, string_view name) {
+  const ServerHandle h{
+      servers_.emplace(std::make_shared<Server>(owner_id, name))};
+  servers_by_name_.emplace(name, h);
+  (*servers_.get(h))->add_member(*find_user(owner_id));
+}
+
+void System::erase_server(ServerHandle h) {
+  // The server is kept alive by the commands using it, if any.
+  const shared_ptr<Server> server{*servers_.get(h)};
+  {
+    // The sessions in its channels aren't subscribed to anything anymore.
+    const std::shared_lock server_lock{server->mutex()};
+    const std::lock_guard lock{subscribers_mutex_};
+    for (const auto& c : server->getChannels()) {
+      if (auto s{subscribers_.find(c.get())}; s != subscribers_.end()) {
+        for (Session* session : s->second) {
+          session->subscribed = nullptr;
+        }
+        subscribers_.erase(s);
+      }
+    }
+  }
+  if (server->shard() != 0) {
+    removed_shards_.push_back(shard_filename(server->shard()));
+  }
+  servers_by_name_.erase(server->getName());
+  servers_.erase(h);
 }
 
-void System::create_server(string_view name) {
-  if (!any_of<const vector<Server>&>(servers_list_, name, check_name)) {
-    servers_list_.emplace_back(current_user_->getId(), name);
-    servers_list_.back().add_member(*current_user_);
-    cout << "Server created\n";
+void System::create_server(string_view args) {
+  const auto parsed{parse_name(args)};
+  if (!parsed || !valid_name(*parsed)) {
+    print_invalid_name(output());
+    return;
+  }
+  const string_view name{*parsed};
+  const int owner_id{ctx().user->getId()};
+  std::unique_lock lock{servers_mutex_};
+  if (!servers_by_name_.contains(name)) {
+    emplace_server(owner_id, name);
+    record({"create-server", std::to_string(owner_id), name});
+    lock.unlock();
+    output() << "Server created\n";
   } else {
-    cout << "There is already a server with that name\n";
+    lock.unlock();
+    output() << "There is already a server with that name\n";
   }
 }
 
 void System::change_description(const ServerDetails& sd) {
-  if (any_of<const vector<Server>&>(servers_list_, sd.name, check_name)) {
-    auto it{find_server(sd.name)};
-    if (it->check_owner(*current_user_)) {
-      it->change_description(sd.description);
-      print_info_changed(make_tuple("Description", sd.name, "changed"));
+  if (const auto s{find_server(sd.name)}; s != nullptr) {
+    std::unique_lock lock{s->mutex()};
+    if (s->check_owner(*ctx().user)) {
+      s->change_description(sd.description);
+      record({"set-server-desc", sd.name, sd.description});
+      lock.unlock();
+      print_info_changed(output(),
+                         make_tuple("Description", sd.name, "changed"));
     } else {
-      print_no_permission("description");
+      lock.unlock();
+      print_no_permission(output(), "description");
     }
   } else {
-    print_absent(sd.name);
+    print_absent(output(), sd.name);
   }
 }
 
 void System::change_invite(const ServerDetails& sd) {
-  if (any_of<const vector<Server>&>(servers_list_, sd.name, check_name)) {
-    auto it{find_server(sd.name)};
-    if (it->check_owner(*current_user_)) {
-      it->change_invite(sd.invite_code);
+  if (const auto s{find_server(sd.name)}; s != nullptr) {
+    std::unique_lock lock{s->mutex()};
+    if (s->check_owner(*ctx().user)) {
+      s->change_invite(sd.invite_code);
+      record({"set-server-invite-code", sd.name, sd.invite_code});
+      lock.unlock();
       if (!sd.invite_code.empty()) {
-        print_info_changed("Invite code", *it, "changed");
+        print_info_changed(output(), "Invite code", *s, "changed");
       } else {
-        print_info_changed("Invite code", *it, "removed");
+        print_info_changed(output(), "Invite code", *s, "removed");
       }
     } else {
-      print_no_permission("invite code");
+      lock.unlock();
+      print_no_permission(output(), "invite code");
     }
   } else {
-    print_absent(sd.name);
+    print_absent(output(), sd.name);
   }
 }
 
 void System::list_servers() const {
-  for (const auto& server : servers_list_) {
-    server.print();
+  // The names are copied first, so the output doesn't hold the list.
+  string out;
+  {
+    const std::shared_lock lock{servers_mutex_};
+    for (const auto& server : servers_.values()) {
+      out += server->getName();
+      out += '\n';
+    }
   }
+  output() << out;
 }
 
-void System::remove_server(string_view name) {
-  if (any_of<const vector<Server>&>(servers_list_, name, check_name)) {
-    auto it{find_server(name)};
-    if (it->check_owner(*current_user_)) {
-      servers_list_.erase(it);
-      cout << "Server '" << name << "' was removed\n";
+void System::remove_server(string_view args) {
+  const auto parsed{parse_name(args)};
+  if (!parsed) {
+    print_invalid_name(output());
+    return;
+  }
+  const string_view name{*parsed};
+  std::unique_lock lock{servers_mutex_};
+  if (auto it{servers_by_name_.find(name)}; it != servers_by_name_.end()) {
+    if (!(*servers_.get(it->second))->check_owner(*ctx().user)) {
+      lock.unlock();
+      output() << "You can't remove a server that isn't yours\n";
+    } else if (!archive_.forget(name)) {
+      // The archive of the server must not be read by another one that
+      // gets its name, so the server is kept until it's forgotten.
+      lock.unlock();
+      print_file_error(archive_.filename());
+      output() << "Server '" << name << "' couldn't be removed\n";
     } else {
-      cout << "You can't remove a server that isn't yours\n";
+      erase_server(it->second);
+      record({"remove-server", name});
+      lock.unlock();
+      output() << "Server '" << name << "' was removed\n";
     }
   } else {
-    print_absent(name);
+    lock.unlock();
+    print_absent(output(), name);
   }
 }
 
 void System::enter_server(const ServerDetails& sd) {
-  if (any_of<const vector<Server>&>(servers_list_, sd.name, check_name)) {
-    auto it{find_server(sd.name)};
-    if (!it->has_invite() || it->check_owner(*current_user_) ||
-        it->check_invite(sd.invite_code)) {
-      current_state_ = kJoinedServer;
-      cout << "Joined server with success\n";
-      if (!it->check_member(*current_user_)) {
-        it->add_member(*current_user_);
+  Context& c{ctx()};
+  std::shared_lock servers_lock{servers_mutex_};
+  auto it{servers_by_name_.find(string_view{sd.name})};
+  if (it == servers_by_name_.end()) {
+    servers_lock.unlock();
+    print_absent(output(), sd.name);
+    return;
+  }
+  const ServerHandle h{it->second};
+  shared_ptr<Server> s{*servers_.get(h)};
+  servers_lock.unlock();
+  {
+    std::unique_lock lock{s->mutex()};
+    if (!s->has_invite() || s->check_owner(*c.user) ||
+        s->check_invite(sd.invite_code)) {
+      if (!s->check_member(*c.user)) {
+        s->add_member(*c.user);
+        record({"join-server", sd.name, std::to_string(c.user->getId())});
       }
-      current_server_ = &*it;
+      lock.unlock();
+      c.state = kJoinedServer;
+      c.server = std::move(s);
+      c.server_handle = h;
+      output() << "Joined server with success\n";
     } else {
-      cout << "Server requires invite code\n";
+      lock.unlock();
+      output() << "Server requires invite code\n";
     }
-  } else {
-    print_absent(sd.name);
   }
 }
 
 void System::leave_server() {
-  if (current_state_ >= kJoinedServer) {
-    cout << "Leaving server '" << *current_server_ << "'\n";
-    current_server_ = nullptr;
-    current_state_ = kLogged_In;
+  Context& c{ctx()};
+  if (c.state >= kJoinedServer) {
+    output() << "Leaving server '" << *c.server << "'\n";
+    c.server = nullptr;
+    c.channel = nullptr;
+    c.state = kLogged_In;
   } else {
-    cout << "You are not visualizing any server\n";
+    output() << "You are not visualizing any server\n";
   }
 }
 
 void System::list_participants() const {
-  ranges::for_each(current_server_->getMembers(),
-                   [this](int id) { cout << get_user_name(id) << '\n'; });
+  vector<int> members;
+  {
+    const std::shared_lock lock{ctx().server->mutex()};
+    members = ctx().server->getMembers();
+  }
+  ranges::for_each(members,
+                   [this](int id) { output() << get_user_name(id) << '\n'; });
 }
 
 // Channel related commands.
 bool System::check_channel(const ChannelDetails& cd) const {
-  return current_server_->check_channel(cd);
-}
-
-constexpr auto System::find_channel(string_view name) {
-  return find_if(
-      current_server_->getChannels().begin(),
-      current_server_->getChannels().end(),
-      [=](const unique_ptr<Channel>& c) { return c->check_name(name); });
+  return ctx().server->check_channel(cd);
 }
 
 void System::list_channels() const {
-  cout << "#Text Channels\n";
-  current_server_->list_text_channels();
-  cout << "#Voice Channels\n";
-  current_server_->list_voice_channels();
+  const Server& s{*ctx().server};
+  const std::shared_lock lock{s.mutex()};
+  output() << "#Text Channels\n";
+  s.list_text_channels(output());
+  output() << "#Voice Channels\n";
+  s.list_voice_channels(output());
 }
 
-void System::emplace_channels(string_view name,
-                              const vector<ChannelDetails>& v) {
-  for (const auto& cd : v) {
-    auto it{find_server(name)};
-    if (cd.type == "text") {
-      auto c = make_unique<TextChannel>(cd);
-      it->create_channel(std::move(c));
-    } else if (cd.type == "text") {
-      auto c = make_unique<VoiceChannel>(cd);
-      it->create_channel(std::move(c));
-    }
+void System::emplace_channels(string_view name, std::span<ChannelDetails> v) {
+  const auto s{find_server(name)};
+  if (s == nullptr) {
+    return;
   }
+  const std::unique_lock lock{s->mutex()};
+  add_channels(*s, v);
 }
 
 void System::create_channel(string_view args) {
   const ChannelDetails cd = parse_details(args);
+  if (!valid_name(cd.name)) {
+    print_invalid_name(output());
+    return;
+  }
+  if (cd.type != "text" && cd.type != "voice") {
+    print_invalid_type(output());
+    return;
+  }
+  Server& s{*ctx().server};
+  std::unique_lock lock{s.mutex()};
   if (!check_channel(cd)) {
     if (cd.type == "text") {
       auto c = make_unique<TextChannel>(cd.name);
-      current_server_->create_channel(std::move(c));
-    } else if (cd.type == "voice") {
+      s.create_channel(std::move(c));
+    } else {
       auto c = make_unique<VoiceChannel>(cd.name);
-      current_server_->create_channel(std::move(c));
+      s.create_channel(std::move(c));
     }
-    print_channel_created(cd);
+    record({"create-channel", s.getName(), cd.name, cd.type});
+    lock.unlock();
+    print_channel_created(output(), cd);
   } else {
-    print_channel_exists(cd);
+    lock.unlock();
+    print_channel_exists(output(), cd);
   }
 }
 
-void System::enter_channel(string_view name) {
-  if (current_server_->any_of(name)) {
-    auto it{find_channel(name)};
-    current_state_ = kJoinedChannel;
-    current_channel_ = &(**it);
-    cout << "Joined '" << name << "' channel\n";
+void System::enter_channel(string_view args) {
+  const auto parsed{parse_name(args)};
+  if (!parsed) {
+    print_invalid_name(output());
+    return;
+  }
+  const string_view name{*parsed};
+  ChannelHandle h;
+  Channel* c{nullptr};
+  {
+    const std::shared_lock lock{ctx().server->mutex()};
+    h = ctx().server->find_channel(name);
+    c = ctx().server->get_channel(h);
+  }
+  if (c != nullptr) {
+    ctx().state = kJoinedChannel;
+    ctx().channel = c;
+    ctx().channel_handle = h;
+    output() << "Joined '" << name << "' channel\n";
   } else {
-    cout << "Channel '" << name << "' doesn't exist\n";
+    output() << "Channel '" << name << "' doesn't exist\n";
   }
 }
 
 void System::leave_channel() {
-  if (current_state_ == kJoinedChannel) {
-    cout << "Leaving channel\n";
-    current_channel_ = nullptr;
-    current_state_ = kJoinedServer;
+  if (ctx().state == kJoinedChannel) {
+    output() << "Leaving channel\n";
+    ctx().channel = nullptr;
+    ctx().state = kJoinedServer;
   } else {
-    cout << "You are not visualizing any channel\n";
+    output() << "You are not visualizing any channel\n";
   }
 }
 
 void System::send_message(string_view msg) {
-  if (check_channel_type<TextChannel>(*current_channel_)) {
-    auto* tc = dynamic_cast<TextChannel*>(current_channel_);
-    current_user_->send_message(tc, msg);
-  } else if (check_channel_type<VoiceChannel>(*current_channel_)) {
-    auto* vc = dynamic_cast<VoiceChannel*>(current_channel_);
-    current_user_->send_message(vc, msg);
+  const Context& c{ctx()};
+  std::unique_lock lock{c.channel->mutex()};
+  const MessageView m{c.user->send_message(c.channel, msg)};
+  c.server->mark_dirty();
+  record({"send-message", c.server->getName(), c.channel->getName(),
+          channel_type(*c.channel), std::to_string(m.sender_id),
+          std::to_string(m.date_time), msg});
+  lock.unlock();
+  publish(*c.channel, m);
+  output() << "Message sent\n";
+}
+
+void System::list_messages(string_view args) {
+  const auto r{parse_range(args)};
+  if (!r) {
+    output() << "Invalid message range\n";
+    return;
+  }
+  const Channel& c{*ctx().channel};
+  // The listing is rendered while the channel is locked, and written after.
+  string out;
+  {
+    std::shared_lock lock{c.mutex()};
+    if (check_channel_type<TextChannel>(c)) {
+      const auto& tc = dynamic_cast<const TextChannel&>(c);
+      // Only the stored messages in the range are read, which changes the
+      // channel, so it's locked exclusively while they're read.
+      if (!tc.covers(*r)) {
+        lock.unlock();
+        {
+          const std::unique_lock exclusive{c.mutex()};
+          tc.load_range(*r);
+        }
+        lock.lock();
+      }
+      for (const auto m : tc.select(*r)) {
+        render_message(out, m);
+      }
+    } else if (check_channel_type<VoiceChannel>(c)) {
+      const auto& vc = dynamic_cast<const VoiceChannel&>(c);
+      const time_t t{vc.getMessage().getDateTime()};
+      if (!vc.empty() && r->limit > 0 && r->offset == 0 && t >= r->after &&
+          t < r->before) {
+        render_message(out, vc.getMessage().view());
+      }
+    }
   }
-  cout << "Message sent\n";
+  output() << (out.empty() ? "No message to show\n" : out);
 }
 
-void System::list_messages() {
-  if (check_channel_type<TextChannel>(*current_channel_)) {
-    auto tc = dynamic_cast<TextChannel&>(*current_channel_);
-    if (tc.empty()) {
-      cout << "No message to show\n";
-    } else {
-      ranges::for_each(tc.getMessages(),
-                       [this](const Message& m) { print_message(m); });
+void System::search_messages(string_view args) const {
+  const auto q{parse_query(args)};
+  if (!q) {
+    output() << "Invalid search\n";
+    return;
+  }
+  string out;
+  const auto search = [&](const Channel& c, bool show_channel) {
+    if (!check_channel_type<TextChannel>(c)) {
+      return;
+    }
+    const auto& tc{dynamic_cast<const TextChannel&>(c)};
+    // The index covers every message, so they're all read first, with the
+    // channel locked exclusively.
+    std::shared_lock lock{c.mutex()};
+    if (!tc.loaded()) {
+      lock.unlock();
+      {
+        const std::unique_lock exclusive{c.mutex()};
+        tc.load_messages();
+      }
+      lock.lock();
+    }
+    for (const size_t i : tc.search(*q)) {
+      if (show_channel) {
+        out += '#';
+        out += c.getName();
+        out += ' ';
+      }
+      render_message(out, tc.getMessages()[i]);
+    }
+  };
+  if (ctx().state == kJoinedChannel) {
+    search(*ctx().channel, false);
+  } else {
+    const std::shared_lock lock{ctx().server->mutex()};
+    for (const auto& c : ctx().server->getChannels()) {
+      search(*c, true);
     }
-  } else if (check_channel_type<VoiceChannel>(*current_channel_)) {
-    auto vc = dynamic_cast<VoiceChannel&>(*current_channel_);
-    if (vc.empty()) {
-      cout << "No message to show\n";
+  }
+  output() << (out.empty() ? "No message found\n" : out);
+}
+
+void System::set_retention(string_view args) {
+  const auto p{parse_retention(args)};
+  if (!p) {
+    output() << "Invalid retention policy\n";
+    return;
+  }
+  Server& s{*ctx().server};
+  const Channel* c{ctx().state == kJoinedChannel ? ctx().channel : nullptr};
+  if (c != nullptr && !check_channel_type<TextChannel>(*c)) {
+    output() << "Only text channels keep their messages\n";
+    return;
+  }
+  const bool removed{Tokenizer{args}.empty()};
+  const string policy{removed ? "" : retention_to_string(*p)};
+  std::unique_lock lock{s.mutex()};
+  if (!s.check_owner(*ctx().user)) {
+    lock.unlock();
+    print_no_permission(output(), "retention");
+    return;
+  }
+  // The policies are only read while the system is held exclusively.
+  const string channel{c != nullptr ? c->getName() : ""};
+  assign_retention(s, channel, policy);
+  record({"set-retention", s.getName(), channel, policy});
+  lock.unlock();
+  const string_view done{removed ? "removed" : "changed"};
+  if (c != nullptr) {
+    output() << "Retention of channel '" << channel << "' was " << done
+             << "!\n";
+  } else {
+    print_info_changed(output(), "Retention", s, done);
+  }
+}
+
+// The archived messages of a channel are read in order, so only the ones in
+// the dates of the range are kept, and the rest of it is selected from them.
+void System::list_archived_messages(string_view args) const {
+  const auto r{parse_range(args)};
+  if (!r) {
+    output() << "Invalid message range\n";
+    return;
+  }
+  MessageLog log;
+  if (check_channel_type<TextChannel>(*ctx().channel)) {
+    archive_.for_each(ctx().server->getName(), ctx().channel->getName(),
+                      [&](const MessageView& m) {
+                        if (m.date_time >= r->after &&
+                            m.date_time < r->before) {
+                          log.push_back(m);
+                        }
+                      });
+  }
+  string out;
+  for (const auto m : log.select(*r)) {
+    render_message(out, m);
+  }
+  output() << (out.empty() ? "No message to show\n" : out);
+}
+
+std::optional<SearchQuery> System::parse_query(string_view args) const {
+  SearchQuery q;
+  Tokenizer t{args};
+  while (const auto token{t.next()}) {
+    const string_view word{*token};
+    if (word.starts_with("from=")) {
+      const std::shared_lock lock{users_mutex_};
+      auto it{users_by_address_.find(word.substr(word.find('=') + 1))};
+      if (it == users_by_address_.end()) {
+        return std::nullopt;
+      }
+      q.sender_id = users_.get(it->second)->getId();
+    } else if (word.starts_with("after=") || word.starts_with("before=")) {
+      const auto date{parse_local_time(word.substr(word.find('=') + 1))};
+      if (!date) {
+        return std::nullopt;
+      }
+      (word.starts_with("after=") ? q.after : q.before) = *date;
     } else {
-      print_message(vc.getMessage());
+      // A prefix term applies to the last word of the term.
+      for_each_word(word,
+                    [&](string_view term) { q.terms.emplace_back(term); });
+      if (word.ends_with('*') && !q.terms.empty()) {
+        q.terms.back() += '*';
+      }
     }
   }
+  if (q.terms.empty()) {
+    return std::nullopt;
+  }
+  return q;
 }
 
-void System::print_message(const Message& m) const {
-  const string date_time{time_to_string(m.getDateTime())};
-  cout << get_user_name(m.getId()) << '<' << date_time
-       << ">: " << m.getContent() << '\n';
+void System::print_message(const MessageView& m) const {
+  string out;
+  render_message(out, m);
+  output() << out;
+}
+
+void System::render_message(string& out, const MessageView& m) const {
+  thread_local TimeFormatter formatter;
+  out += get_user_name(m.sender_id);
+  out += '<';
+  out += formatter.format(m.date_time);
+  out += ">: ";
+  out += m.content;
+  out += '\n';
 }
 
 // Save/Load system methods.
-void System::save_users() {
-  const string fn{"users.txt"};
+// The channels whose messages weren't read yet keep reading them from the
+// current files, and a crash while writing would lose them, so the new ones
+// are written aside.
+std::optional<System::PendingSave> System::write_files() {
+  // The files of the last save can't be written aside again until it's done.
+  if (!finish_commit()) {
+    return std::nullopt;
+  }
+  apply_retention();
+  PendingSave files;
+  files.sequence = journal_.sequence();
+  bool written{false};
+  if (format_ == StorageFormat::kBinary) {
+    files.written = {"concordo.snap"};
+    written = save_snapshot("concordo.snap.tmp");
+  } else if (format_ == StorageFormat::kSharded) {
+    files.written = {"users.txt"};
+    written = save_users("users.txt.tmp") && save_shards(files);
+  } else {
+    files.written = {"users.txt", "servers.txt"};
+    written = save_users("users.txt.tmp") && save_servers("servers.txt.tmp");
+  }
+  if (!written || !save_retention(files)) {
+    return std::nullopt;
+  }
+  return files;
+}
+
+// The files are durable before the save is committed, so they can be replaced
+// again if a crash stops it.
+bool System::commit_files(const PendingSave& files) {
+  for (const string& fn : files.written) {
+    if (!sync_file(fn + ".tmp")) {
+      print_file_error(fn + ".tmp");
+      resave_shards_ = true;
+      return false;
+    }
+  }
+  if (!save_commit(files)) {
+    print_file_error("commit.txt");
+    resave_shards_ = true;
+    return false;
+  }
+  return finish_commit();
+}
+
+// The files already replaced have nothing written aside anymore, so they're
+// skipped.
+bool System::finish_commit() {
+  PendingSave files;
+  {
+    fstream f{"commit.txt", std::ios::in};
+    const string_view line{read_line(f)};
+    std::from_chars(line.data(), line.data() + line.size(), files.sequence);
+    for (auto* list : {&files.written, &files.removed}) {
+      for (int n{read_number(f)}; n > 0; --n) {
+        list->emplace_back(read_line(f));
+      }
+    }
+  }
+  saved_sequence_ = files.sequence;
+  if (files.written.empty() && files.removed.empty()) {
+    return true;
+  }
+  for (const string& fn : files.written) {
+    if (std::filesystem::exists(fn + ".tmp") &&
+        !replace_file(fn + ".tmp", fn)) {
+      print_file_error(fn);
+      return false;
+    }
+  }
+  for (const string& fn : files.removed) {
+    std::remove(fn.c_str());
+  }
+  // The files written aside by the next save aren't part of this one.
+  PendingSave done;
+  done.sequence = files.sequence;
+  if (!save_commit(done)) {
+    print_file_error("commit.txt");
+    return false;
+  }
+  return true;
+}
+
+void System::wait_for_save() {
+  if (saver_.joinable()) {
+    saver_.join();
+  }
+}
+
+bool System::save_users(const string& fn) {
   fstream f{fn, std::ios::out | std::ios::trunc};
   if (!f) {
     print_file_error(fn);
-    return;
+    return false;
   }
-  f << users_list_.size() << '\n';
-  for (auto& user : users_list_) {
+  f << users_.size() << '\n';
+  for (const auto& user : users_.values()) {
     user.save(f);
   }
+  f.close();
+  return static_cast<bool>(f);
 }
 
-void System::save_servers() {
-  const string fn{"servers.txt"};
-  fstream f{fn, std::ios::trunc | std::ios::out};
+bool System::save_servers(const string& fn) {
+  fstream f{fn, std::ios::out | std::ios::trunc};
   if (!f) {
     print_file_error(fn);
+    return false;
+  }
+  f << servers_.size() << '\n';
+  for (const auto& server : servers_.values()) {
+    server->save(f);
+  }
+  f.close();
+  return static_cast<bool>(f);
+}
+
+bool System::save_snapshot(const string& fn) {
+  SnapshotWriter w{compress_};
+  for (const auto& user : users_.values()) {
+    user.save(w);
+  }
+  for (const auto& server : servers_.values()) {
+    server->save(w);
+  }
+  if (!w.write(fn, last_id_)) {
+    print_file_error(fn);
+    return false;
+  }
+  return true;
+}
+
+// The manifest holds the last number given to a server file, and then the
+// number of every server file, in the order they're loaded. The files that
+// couldn't be loaded are listed last, so they're loaded again.
+bool System::save_shards(PendingSave& files) {
+  std::error_code ec;
+  std::filesystem::create_directories("servers", ec);
+  const bool all{resave_shards_.exchange(false)};
+  for (const auto& server : servers_.values()) {
+    const bool dirty{server->take_dirty()};
+    if (server->shard() == 0) {
+      server->set_shard(++last_shard_);
+    } else if (!dirty && !all) {
+      continue;
+    }
+    const string fn{shard_filename(server->shard())};
+    // The channels whose messages weren't read still read them from the file
+    // replaced.
+    if (!server->pin_file()) {
+      print_file_error(fn);
+      resave_shards_ = true;
+      return false;
+    }
+    fstream f{fn + ".tmp", std::ios::out | std::ios::trunc};
+    server->save(f);
+    f.close();
+    if (!f) {
+      // The servers already taken as saved are written on the next save.
+      print_file_error(fn + ".tmp");
+      resave_shards_ = true;
+      return false;
+    }
+    files.written.push_back(fn);
+  }
+
+  const string fn{"manifest.txt"};
+  fstream f{fn + ".tmp", std::ios::out | std::ios::trunc};
+  f << last_shard_ << '\n'
+    << servers_.size() + unloaded_shards_.size() << '\n';
+  for (const auto& server : servers_.values()) {
+    f << server->shard() << '\n';
+  }
+  for (const int shard : unloaded_shards_) {
+    f << shard << '\n';
+  }
+  f.close();
+  if (!f) {
+    print_file_error(fn + ".tmp");
+    resave_shards_ = true;
+    return false;
+  }
+  files.written.push_back(fn);
+  files.removed = std::exchange(removed_shards_, {});
+  return true;
+}
+
+// Every policy is written in a line like the set-retention records, and the
+// ones of the servers have no channel.
+bool System::save_retention(PendingSave& files) {
+  const string fn{"retention.txt"};
+  string out;
+  const auto add = [&out](string_view server, string_view channel,
+                          const RetentionPolicy& p) {
+    append_token(out, server);
+    out += ' ';
+    append_token(out, channel);
+    out += ' ';
+    out += retention_to_string(p);
+    out += '\n';
+  };
+  for (const auto& server : servers_.values()) {
+    if (server->retention().limited()) {
+      add(server->getName(), "", server->retention());
+    }
+    for (const auto& c : server->getChannels()) {
+      if (!check_channel_type<TextChannel>(*c)) {
+        continue;
+      }
+      const auto& tc{dynamic_cast<const TextChannel&>(*c)};
+      if (tc.retention()) {
+        add(server->getName(), tc.getName(), *tc.retention());
+      }
+    }
+  }
+  if (out.empty()) {
+    files.removed.push_back(fn);
+    return true;
+  }
+  fstream f{fn + ".tmp", std::ios::out | std::ios::trunc};
+  f << out;
+  f.close();
+  if (!f) {
+    print_file_error(fn + ".tmp");
+    resave_shards_ = true;
+    return false;
+  }
+  files.written.push_back(fn);
+  return true;
+}
+
+// commit.txt holds the number of the last journal record the files hold, and
+// then the amount of files replaced and their names, and the same for the ones
+// deleted. The files saved before it existed have none, so every journal
+// record is replayed.
+bool System::save_commit(const PendingSave& files) {
+  const string fn{"commit.txt"};
+  fstream f{fn + ".tmp", std::ios::out | std::ios::trunc};
+  f << files.sequence << '\n';
+  for (const auto* list : {&files.written, &files.removed}) {
+    f << list->size() << '\n';
+    for (const string& name : *list) {
+      f << name << '\n';
+    }
+  }
+  f.close();
+  return f && replace_file(fn + ".tmp", fn);
+}
+
+// The messages are only taken out of the channels once the archive holding
+// them is durable, so they're kept if it can't be written. If the files
+// weren't saved after it was, the archive has more messages of a channel than
+// the channel counts, and those are taken out without being archived again.
+void System::apply_retention() {
+  const time_t now{system_clock::to_time_t(system_clock::now())};
+  vector<tuple<Server*, TextChannel*, size_t>> expired;
+  for (const auto& server : servers_.values()) {
+    for (const auto& c : server->getChannels()) {
+      if (!check_channel_type<TextChannel>(*c)) {
+        continue;
+      }
+      auto& tc{dynamic_cast<TextChannel&>(*c)};
+      const RetentionPolicy p{tc.retention().value_or(server->retention())};
+      if (!p.limited()) {
+        continue;
+      }
+      const string name{server->getName()};
+      const string channel{tc.getName()};
+      const size_t archived{archive_.archived(name, channel)};
+      size_t skip{archived > tc.archived() ? archived - tc.archived() : 0};
+      const size_t n{
+          tc.for_each_expired(p, now, skip, [&](const MessageView& m) {
+            if (skip > 0) {
+              --skip;
+            } else {
+              archive_.add(name, channel, m);
+            }
+          })};
+      if (n > 0) {
+        expired.emplace_back(server.get(), &tc, n);
+      }
+    }
+  }
+  if (expired.empty()) {
     return;
   }
-  f << servers_list_.size() << '\n';
-  for (auto& server : servers_list_) {
-    server.save(f);
+  if (!archive_.write()) {
+    print_file_error(archive_.filename());
+    return;
+  }
+  for (const auto& [server, tc, n] : expired) {
+    tc->archive_oldest(n);
+    server->mark_dirty();
+  }
+}
+
+void System::load_retention() {
+  fstream f{"retention.txt", std::ios::in};
+  string line;
+  while (getline(f, line)) {
+    Tokenizer t{line};
+    const auto s{find_server(t.next().value_or(""))};
+    const string_view channel{t.next().value_or("")};
+    if (s != nullptr) {
+      assign_retention(*s, channel, t.raw());
+    }
   }
 }
 
+void System::clear_users() {
+  users_.clear();
+  users_by_id_.clear();
+  users_by_address_.clear();
+  user_names_.clear();
+  last_id_ = 0;
+}
+
+void System::clear_servers() {
+  servers_.clear();
+  servers_by_name_.clear();
+  removed_shards_.clear();
+  unloaded_shards_.clear();
+}
+
 void System::load_users() {
   const string fn{"users.txt"};
   fstream f{fn, std::ios::in | std::ios::out};
   if (!f) {
     print_file_error(fn);
   } else if (f.peek() != fstream::traits_type::eof()) {
-    users_list_.clear();
-    last_id_ = 0;
-    string up_bound;
-    getline(f, up_bound);
-    UserCredentials c;
-    for (int i{0}; i < stoi(up_bound); ++i) {
-      c = parse_users_file(f);
-      emplace_user(c);
+    clear_users();
+    LoadArena arena;
+    const int n{read_number(f)};
+    for (int i{0}; i < n; ++i) {
+      arena.rewind();
+      emplace_user(parse_users_file(f, arena.allocator()));
     }
   }
 }
 
+// The file is replaced by every save, so it's pinned for the channels whose
+// messages weren't read, which are all of them.
 void System::load_servers() {
   const string fn{"servers.txt"};
   fstream f{fn, std::ios::in | std::ios::out};
-  if (!f) {
+  auto file{std::make_shared<MessageFile>(fn)};
+  if (!f || !file->pin()) {
     print_file_error(fn);
   } else if (f.peek() != fstream::traits_type::eof()) {
-    servers_list_.clear();
+    clear_servers();
     string up_bound;
     getline(f, up_bound);
+    // Only the servers and channels built from the details outlive the arena.
+    LoadArena arena;
     for (int i{0}; i < stoi(up_bound); ++i) {
-      auto [d, v] = parse_servers_file(f);
-      servers_list_.emplace_back(d);
+      arena.rewind();
+      auto [d, v] = parse_servers_file(f, file, arena.allocator());
+      servers_by_name_.emplace(d.name,
+                               servers_.emplace(std::make_shared<Server>(d)));
       emplace_channels(d.name, v);
     }
   }
 }
 
-// System related helper functions.
-bool check_command(const unordered_set<string>& s, string_view c) {
-  return s.contains(string(c));
+// Every server is parsed by a thread of the pool, building it apart from the
+// system, and then they're added to the system in the manifest order. The
+// server files are closed once parsed, and only opened again to read the
+// messages of their channels.
+void System::load_shards() {
+  const string fn{"manifest.txt"};
+  fstream f{fn, std::ios::in};
+  if (!f) {
+    print_file_error(fn);
+    return;
+  }
+  clear_servers();
+  last_shard_ = read_number(f);
+  vector<pair<int, shared_ptr<Server>>> loaded(
+      static_cast<size_t>(std::max(read_number(f), 0)));
+  {
+    ThreadPool pool{load_threads_};
+    for (auto& [shard, server] : loaded) {
+      shard = read_number(f);
+      pool.submit([&server, shard] {
+        const string shard_fn{shard_filename(shard)};
+        fstream sf{shard_fn, std::ios::in};
+        if (!sf) {
+          print_file_error(shard_fn);
+          return;
+        }
+        auto file{std::make_shared<MessageFile>(shard_fn)};
+        LoadArena arena;
+        auto [d, v] = parse_servers_file(sf, file, arena.allocator());
+        server = std::make_shared<Server>(d);
+        add_channels(*server, v);
+        server->set_shard(shard);
+        server->set_file(file);
+        server->take_dirty();
+      });
+    }
+    pool.wait();
+  }
+  for (auto& [shard, server] : loaded) {
+    if (server) {
+      const string name{server->getName()};
+      servers_by_name_.emplace(name, servers_.emplace(std::move(server)));
+    } else {
+      unloaded_shards_.push_back(shard);
+    }
+  }
 }
 
-string parse_cmd(string_view cmd_line) {
-  string cmd;
-  for (const auto c : views::split(cmd_line, ' ')) {
-    cmd = {c.begin(), c.end()};
-    break;
+void System::load_snapshot() {
+  const string fn{"concordo.snap"};
+  // The mapping is kept alive by the channels whose messages weren't read.
+  auto snap{std::make_shared<Snapshot>()};
+  if (!snap->open(fn)) {
+    print_file_error(fn);
+    return;
+  }
+  LoadArena arena;
+  clear_users();
+  for (const auto& u : snap->users()) {
+    arena.rewind();
+    UserCredentials c{arena.allocator()};
+    c.id = u.id;
+    c.address = snap->str(u.address);
+    c.password = snap->str(u.password);
+    c.name = snap->str(u.name);
+    emplace_user(c);
+  }
+  last_id_ = snap->header().last_id;
+  clear_servers();
+  for (const auto& s : snap->servers()) {
+    arena.rewind();
+    const auto members{snap->members(s)};
+    ServerDetails d{arena.allocator()};
+    d.owner_id = s.owner_id;
+    d.name = snap->str(s.name);
+    d.description = snap->str(s.description);
+    d.invite_code = snap->str(s.invite_code);
+    d.members_ids.assign(members.begin(), members.end());
+    std::pmr::vector<ChannelDetails> v{arena.allocator()};
+    v.reserve(snap->channels(s).size());
+    for (const auto& c : snap->channels(s)) {
+      ChannelDetails& cd{v.emplace_back(arena.allocator())};
+      cd.name = snap->str(c.name);
+      cd.type = snap->str(c.type);
+      cd.archived = c.archived;
+      if (cd.type == "text") {
+        if (c.blocks_count > 0) {
+          cd.source = std::make_shared<CompressedMessageSource>(
+              snap, snap->blocks(c));
+        } else {
+          cd.source = std::make_shared<SnapshotMessageSource>(snap, c);
+        }
+        continue;
+      }
+      for (const auto& m : snap->messages(c)) {
+        cd.messages.emplace_back(MessageView{m.date_time, m.sender_id,
+                                             snap->str(m.content)});
+      }
+    }
+    servers_by_name_.emplace(d.name,
+                             servers_.emplace(std::make_shared<Server>(d)));
+    emplace_channels(d.name, v);
   }
-  return cmd;
 }
 
-bool check_args(string_view cmd_line) {
-  ranges::split_view sv{cmd_line, ' '};
-  return ranges::distance(sv.begin(), sv.end()) > 1;
+void System::convert(StorageFormat to) {
+  load();
+  replay_journal();
+  format_ = to;
+  compact();
 }
 
-string parse_args(string_view cmd_line) {
-  string args;
-  for (int i{0}; const auto a : views::split(cmd_line, ' ')) {
+// Journal related methods.
+void System::record(std::initializer_list<string_view> fields) {
+  if (Batch& b{ctx().batch}; b.started) {
+    b.changed = true;
+    return;
+  }
+  string r;
+  for (size_t i{0}; const auto f : fields) {
     if (i > 0) {
-      args += {a.begin(), a.end()};
-      args += " ";
+      r += ' ';
+    }
+    // The last field is read back as the rest of the record.
+    if (++i < fields.size()) {
+      append_token(r, f);
+    } else {
+      r += f;
+    }
+  }
+  journal_.append(r);
+}
+
+void System::maybe_compact() {
+  if (!ctx().batch.started && journal_.size() >= kCompactionThreshold) {
+    // Another command may have compacted it while this one waited.
+    const std::unique_lock lock{state_mutex_};
+    if (journal_.size() >= kCompactionThreshold) {
+      compact();
     }
-    ++i;
   }
-  args.pop_back();
-  return args;
 }
 
+void System::sync() {
+  if (ctx().batch.started) {
+    output() << "The batch is only saved when committed\n";
+  } else if (journal_.sync()) {
+    output() << "Every change was saved\n";
+  } else {
+    output() << "Could not save every change\n";
+  }
+}
+
+void System::begin_batch() {
+  Batch& b{ctx().batch};
+  if (b.started) {
+    output() << "A batch was already started\n";
+    return;
+  }
+  b = Batch{true, false, 0, std::chrono::steady_clock::now()};
+  output() << "Batch started\n";
+}
+
+void System::commit_batch() {
+  if (!ctx().batch.started) {
+    output() << "No batch was started\n";
+    return;
+  }
+  const Batch b{end_batch(ctx().batch)};
+  const auto ms{std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - b.start)};
+  output() << "Batch committed: " << b.commands << " commands in "
+           << ms.count() << " ms\n";
+}
+
+System::Batch System::end_batch(Batch& b) {
+  const Batch ended{std::exchange(b, {})};
+  if (ended.changed) {
+    compact();
+  }
+  return ended;
+}
+
+void System::compact() {
+  wait_for_save();
+  auto files{write_files()};
+  if (!files) {
+    return;
+  }
+  if (!background_saves_) {
+    if (commit_files(*files)) {
+      journal_.clear();
+    }
+    return;
+  }
+  // The records appended from now on aren't part of the files written, and
+  // the files aren't committed if the records they hold can't be set aside.
+  if (!journal_.rotate()) {
+    resave_shards_ = true;
+    return;
+  }
+  saver_ = std::jthread{[this, f = std::move(*files)] {
+    if (commit_files(f)) {
+      journal_.discard_rotated();
+    }
+  }};
+}
+
+void System::replay_journal() {
+  journal_.replay(saved_sequence_, [this](string_view r) { apply_record(r); });
+}
+
+void System::apply_record(string_view r) {
+  Tokenizer t{r};
+  const auto token = [&t] { return t.next().value_or(""); };
+  const string_view cmd{token()};
+  if (cmd == "create-user") {
+    // The id is generated again, in the same order, unless the user was saved
+    // by a compaction that couldn't discard the journal, and is already here.
+    token();
+    UserCredentials c;
+    c.address = token();
+    c.password = token();
+    c.name = t.raw();
+    if (!users_by_address_.contains(string_view{c.address})) {
+      emplace_user(c);
+    }
+  } else if (cmd == "create-server") {
+    const string_view owner_id{token()};
+    emplace_server(stoi(string(owner_id)), t.raw());
+  } else if (cmd == "set-server-desc") {
+    if (const auto s{find_server(token())}; s != nullptr) {
+      s->change_description(t.raw());
+    }
+  } else if (cmd == "set-server-invite-code") {
+    if (const auto s{find_server(token())}; s != nullptr) {
+      s->change_invite(t.raw());
+    }
+  } else if (cmd == "remove-server") {
+    const std::unique_lock lock{servers_mutex_};
+    if (auto it{servers_by_name_.find(t.raw())};
+        it != servers_by_name_.end()) {
+      erase_server(it->second);
+    }
+  } else if (cmd == "join-server") {
+    if (const auto s{find_server(token())}; s != nullptr) {
+      s->add_member(*find_user(stoi(string(t.raw()))));
+    }
+  } else if (cmd == "create-channel") {
+    const string_view server{token()};
+    ChannelDetails cd;
+    cd.name = token();
+    cd.type = t.raw();
+    emplace_channels(server, {&cd, 1});
+  } else if (cmd == "send-message") {
+    const string_view server{token()};
+    const string_view name{token()};
+    const string_view type{token()};
+    const string_view sender_id{token()};
+    const string_view date_time{token()};
+    const auto s{find_server(server)};
+    Channel* c{s != nullptr ? s->get_channel(s->find_channel(name, type))
+                            : nullptr};
+    if (c != nullptr) {
+      c->send_message(MessageView{stoll(string(date_time)),
+                                  stoi(string(sender_id)), t.raw()});
+      s->mark_dirty();
+    }
+  } else if (cmd == "set-retention") {
+    const string_view server{token()};
+    const string_view channel{token()};
+    if (const auto s{find_server(server)}; s != nullptr) {
+      assign_retention(*s, channel, t.raw());
+    }
+  }
+}
+
+// System related helper functions.
 ServerDetails parse_details(string_view args, int cmd) {
   enum Command {
     kDescription,  // "set-server-description"
@@ -510,22 +1621,12 @@ ServerDetails parse_details(string_view args, int cmd) {
     kEnter         // "enter-server"
   };
   ServerDetails d;
-  for (int i{0}; const auto a : views::split(args, ' ')) {
-    if (cmd == kEnter || cmd == kInvite) {
-      if (i == 0) {
-        d.name = {a.begin(), a.end()};
-      } else {
-        d.invite_code = {a.begin(), a.end()};
-      }
-    } else {
-      if (i == 0) {
-        d.name = {a.begin(), a.end()};
-      } else {
-        d.description += {a.begin(), a.end()};
-      }
-    }
-
-    ++i;
+  Tokenizer t{args};
+  d.name = t.next().value_or("");
+  if (cmd == kEnter || cmd == kInvite) {
+    d.invite_code = t.next().value_or("");
+  } else {
+    d.description = t.rest();
   }
   return d;
 }
@@ -541,39 +1642,26 @@ bool check_password(const User& u, string_view p) {
 
 UserCredentials parse_new_credentials(string_view cred) {
   UserCredentials c;
-  for (int i{0}; const auto w : views::split(cred, ' ')) {
-    switch (i) {
-      case 0:
-        c.address = {w.begin(), w.end()};
-        break;
-      case 1:
-        c.password = {w.begin(), w.end()};
-        break;
-      default:
-        c.name += {w.begin(), w.end()};
-        c.name += " ";
-        break;
-    }
-    ++i;
-  }
-  c.name.pop_back();
+  Tokenizer t{cred};
+  c.address = t.next().value_or("");
+  c.password = t.next().value_or("");
+  c.name = t.rest();
   return c;
 }
 
 UserCredentials parse_credentials(string_view cred) {
   UserCredentials c;
-  for (int i{0}; const auto w : views::split(cred, ' ')) {
-    if (i == 0) {
-      c.address = {w.begin(), w.end()};
-    } else {
-      c.password = {w.begin(), w.end()};
-    }
-    ++i;
-  }
+  Tokenizer t{cred};
+  c.address = t.next().value_or("");
+  c.password = t.next().value_or("");
   return c;
 }
 
 // Server related helping functions.
+string_view channel_type(const Channel& c) {
+  return check_channel_type<TextChannel>(c) ? "text" : "voice";
+}
+
 bool check_name(const Server& s, string_view name) {
   return s.check_name(name);
 }
@@ -584,137 +1672,220 @@ bool check_channel_name(const unique_ptr<Channel>& c, string_view name) {
 }
 
 // Save/Load helping functions.
-UserCredentials parse_users_file(fstream& f) {
-  UserCredentials c;
-  string s;
-  getline(f, s);
-  c.id = stoi(s);
-  getline(f, c.name);
-  getline(f, c.address);
-  getline(f, c.password);
+UserCredentials parse_users_file(fstream& f, DetailsAllocator alloc) {
+  UserCredentials c{alloc};
+  c.id = read_number(f);
+  c.name = read_line(f);
+  c.address = read_line(f);
+  c.password = read_line(f);
   return c;
 }
 
+std::optional<string_view> parse_name(string_view args) {
+  Tokenizer t{args};
+  const auto name{t.next()};
+  if (!t.empty()) {
+    return std::nullopt;
+  }
+  return name.value_or("");
+}
+
+bool valid_name(string_view name) {
+  return name.find('"') == string_view::npos;
+}
+
 ChannelDetails parse_details(string_view args) {
   ChannelDetails d;
-  for (int i{0}; const auto w : views::split(args, ' ')) {
-    if (i == 0) {
-      d.name = {w.begin(), w.end()};
+  Tokenizer t{args};
+  d.name = t.next().value_or("");
+  d.type = t.next().value_or("");
+  return d;
+}
+
+std::optional<MessageRange> parse_range(string_view args) {
+  MessageRange r;
+  int positional{0};
+  Tokenizer t{args};
+  while (const auto token{t.next()}) {
+    const string_view word{*token};
+    const char* last{word.data() + word.size()};
+    std::optional<time_t> date;
+    size_t n{};
+    if (word.empty()) {
+      continue;
+    }
+    if (word.starts_with("after=")) {
+      date = parse_local_time(word.substr(word.find('=') + 1));
+      r.after = date.value_or(0);
+    } else if (word.starts_with("before=")) {
+      date = parse_local_time(word.substr(word.find('=') + 1));
+      r.before = date.value_or(0);
+    } else if (auto [p, ec] = std::from_chars(word.data(), last, n);
+               ec == std::errc{} && p == last && positional < 2) {
+      (positional++ == 0 ? r.limit : r.offset) = n;
+      continue;
+    }
+    if (!date) {
+      return std::nullopt;
+    }
+  }
+  return r;
+}
+
+std::optional<RetentionPolicy> parse_retention(string_view args) {
+  RetentionPolicy p;
+  Tokenizer t{args};
+  while (const auto token{t.next()}) {
+    const string_view word{*token};
+    const auto eq{word.find('=')};
+    if (eq == string_view::npos || eq + 1 == word.size()) {
+      return std::nullopt;
+    }
+    const char* last{word.data() + word.size()};
+    int n{};
+    auto [ptr, ec] = std::from_chars(word.data() + eq + 1, last, n);
+    if (ec != std::errc{} || ptr != last || n < 0) {
+      return std::nullopt;
+    }
+    if (word.starts_with("count=")) {
+      p.max_messages = static_cast<size_t>(n);
+    } else if (word.starts_with("age=")) {
+      p.max_age = std::chrono::days{n};
     } else {
-      d.type = {w.begin(), w.end()};
+      return std::nullopt;
     }
-    ++i;
   }
-  return d;
+  return p;
+}
+
+string retention_to_string(const RetentionPolicy& p) {
+  return "count=" + std::to_string(p.max_messages) +
+         " age=" + std::to_string(p.max_age.count());
 }
 
-pair<ServerDetails, vector<ChannelDetails>> parse_servers_file(fstream& f) {
-  const ServerDetails d{parse_server_details(f)};
-  vector<ChannelDetails> v;
-  string up_bound;
-  getline(f, up_bound);
-  for (int i{0}; i < stoi(up_bound); ++i) {
-    v.push_back(parse_channel_details(f));
+pair<ServerDetails, std::pmr::vector<ChannelDetails>> parse_servers_file(
+    fstream& f, const shared_ptr<MessageFile>& file, DetailsAllocator alloc) {
+  pair<ServerDetails, std::pmr::vector<ChannelDetails>> p{
+      parse_server_details(f, alloc), std::pmr::vector<ChannelDetails>{alloc}};
+  const int n{read_number(f)};
+  p.second.reserve(static_cast<size_t>(std::max(n, 0)));
+  for (int i{0}; i < n; ++i) {
+    p.second.push_back(parse_channel_details(f, file, alloc));
   }
-  return {d, v};
+  return p;
 }
 
-vector<int> parse_members_ids(fstream& f, int up_bound) {
-  vector<int> v;
-  string id;
+std::pmr::vector<int> parse_members_ids(fstream& f, int up_bound,
+                                        DetailsAllocator alloc) {
+  std::pmr::vector<int> v{alloc};
+  v.reserve(static_cast<size_t>(std::max(up_bound, 0)));
   for (int i{0}; i < up_bound; ++i) {
-    getline(f, id);
-    v.push_back(stoi(id));
+    v.push_back(read_number(f));
   }
   return v;
 }
 
-ServerDetails parse_server_details(fstream& f) {
-  ServerDetails d;
-  string s;
-  getline(f, s);
-  d.owner_id = stoi(s);
-  getline(f, d.name);
-  getline(f, d.description);
-  getline(f, d.invite_code);
-  getline(f, s);
-  d.members_ids = parse_members_ids(f, stoi(s));
+ServerDetails parse_server_details(fstream& f, DetailsAllocator alloc) {
+  ServerDetails d{alloc};
+  d.owner_id = read_number(f);
+  d.name = read_line(f);
+  d.description = read_line(f);
+  d.invite_code = read_line(f);
+  const int members{read_number(f)};
+  d.members_ids = parse_members_ids(f, members, alloc);
   return d;
 }
 
-time_t string_to_time(const string& s) {
-  std::stringstream ss(s);
-  std::tm tm{};
-  ss >> std::get_time(&tm, "%d/%m/%Y - %H:%M");
-  return std::mktime(&tm);
-}
-
-MessageDetails parse_message(fstream& f) {
-  MessageDetails d;
-  string s;
-  getline(f, s);
-  d.sender_id = stoi(s);
-  getline(f, s);
-  d.date_time = string_to_time(s);
-  getline(f, d.content);
+MessageDetails parse_message(fstream& f, DetailsAllocator alloc) {
+  MessageDetails d{0, 0, std::pmr::string{alloc}};
+  d.sender_id = read_number(f);
+  d.date_time = string_to_time(read_line(f));
+  d.content = read_line(f);
   return d;
 }
 
-ChannelDetails parse_channel_details(fstream& f) {
-  ChannelDetails d;
-  getline(f, d.name);
-  getline(f, d.type);
+ChannelDetails parse_channel_details(fstream& f,
+                                     const shared_ptr<MessageFile>& file,
+                                     DetailsAllocator alloc) {
+  ChannelDetails d{alloc};
+  d.name = read_line(f);
+  d.type = read_line(f);
+  // A text channel that had messages archived counts them after its type.
+  if (const auto space{d.type.find(' ')}; space != string::npos) {
+    std::from_chars(d.type.data() + space + 1, d.type.data() + d.type.size(),
+                    d.archived);
+    d.type.resize(space);
+  }
   std::transform(d.type.begin(), d.type.end(), d.type.begin(),
                  [](unsigned char c) { return std::tolower(c); });
-  string up_bound;
-  getline(f, up_bound);
-  for (int i{0}; i < stoi(up_bound); ++i) {
-    d.messages.emplace_back(parse_message(f));
+  const auto n{static_cast<size_t>(read_number(f))};
+  if (d.type == "text") {
+    // The messages are skipped, to be read when they are needed.
+    d.source = std::make_shared<TextMessageSource>(file, f.tellg(), n);
+    for (size_t i{0}; i < n * 3; ++i) {
+      f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return d;
+  }
+  for (size_t i{0}; i < n; ++i) {
+    d.messages.emplace_back(parse_message(f, alloc));
   }
   return d;
 }
 
 // Print related helping functions.
-void print_absent(string_view name) {
-  cout << "Server '" << name << "' doesn't exist\n";
+void print_absent(ostream& out, string_view name) {
+  out << "Server '" << name << "' doesn't exist\n";
 }
 
-void print_no_permission(string_view sv) {
-  cout << "You can't change the " << sv << " of a server that isn't yours\n";
+void print_no_permission(ostream& out, string_view sv) {
+  out << "You can't change the " << sv << " of a server that isn't yours\n";
 }
 
-void print_info_changed(tuple<string_view, string_view, string_view> info) {
-  cout << get<0>(info) << " of server '" << get<1>(info) << "' was "
-       << get<2>(info) << "!\n";
+void print_info_changed(ostream& out,
+                        tuple<string_view, string_view, string_view> info) {
+  out << get<0>(info) << " of server '" << get<1>(info) << "' was "
+      << get<2>(info) << "!\n";
+}
+
+void print_info_changed(ostream& out, string_view wc1, const Server& s,
+                        string_view wc2) {
+  out << wc1 << " of server '" << s << "' was " << wc2 << "!\n";
+}
+
+void print_unable(ostream& out) { out << "You can't do that right now\n"; }
+
+void print_invalid_name(ostream& out) {
+  out << "Invalid name: quote it if it has spaces, and it can't have double "
+         "quotes\n";
 }
 
-void print_info_changed(string_view wc1, const Server& s, string_view wc2) {
-  cout << wc1 << " of server '" << s << "' was " << wc2 << "!\n";
+void print_invalid_type(ostream& out) {
+  out << "Invalid type: a channel is either text or voice\n";
 }
 
-void print_unable() { cout << "You can't do that right now\n"; }
-void print_channel_created(const ChannelDetails& cd) {
+void print_channel_created(ostream& out, const ChannelDetails& cd) {
   if (cd.type == "text") {
-    print_channel_created("Text", cd.name);
+    print_channel_created(out, "Text", cd.name);
   } else if (cd.type == "voice") {
-    print_channel_created("Voice", cd.name);
+    print_channel_created(out, "Voice", cd.name);
   }
 }
 
-void print_channel_created(string_view type, string_view name) {
-  cout << type << " Channel '" << name << "' created\n";
+void print_channel_created(ostream& out, string_view type, string_view name) {
+  out << type << " Channel '" << name << "' created\n";
 }
 
-void print_channel_exists(const ChannelDetails& cd) {
+void print_channel_exists(ostream& out, const ChannelDetails& cd) {
   if (cd.type == "text") {
-    print_channel_exists("Text", cd.name);
+    print_channel_exists(out, "Text", cd.name);
   } else if (cd.type == "voice") {
-    print_channel_exists("Voice", cd.name);
+    print_channel_exists(out, "Voice", cd.name);
   }
 }
 
-void print_channel_exists(string_view type, string_view name) {
-  cout << type << " Channel '" << name << "' already exists\n";
+void print_channel_exists(ostream& out, string_view type, string_view name) {
+  out << type << " Channel '" << name << "' already exists\n";
 }
 
 void print_file_error(string_view filename) {
@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace concordo {
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  for (size_t i{0}; i < threads; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  // The queues are all made before any thread may steal from them.
+  for (size_t i{0}; i < threads; ++i) {
+    workers_.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  stopping_ = true;
+  queued_.release(static_cast<std::ptrdiff_t>(workers_.size()));
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  Queue& q{*queues_[next_++ % queues_.size()]};
+  ++pending_;
+  {
+    const std::lock_guard lock{q.mutex};
+    q.tasks.push_back(std::move(task));
+  }
+  queued_.release();
+}
+
+void ThreadPool::wait() {
+  size_t pending{pending_.load()};
+  while (pending > 0) {
+    pending_.wait(pending);
+    pending = pending_.load();
+  }
+}
+
+void ThreadPool::work(size_t self) {
+  while (true) {
+    queued_.acquire();
+    // Every permit but the ones released to stop is a task in some queue.
+    std::function<void()> task{take(self)};
+    if (!task) {
+      return;
+    }
+    task();
+    if (--pending_ == 0) {
+      pending_.notify_all();
+    }
+  }
+}
+
+std::function<void()> ThreadPool::take(size_t self) {
+  while (true) {
+    for (size_t i{0}; i < queues_.size(); ++i) {
+      Queue& q{*queues_[(self + i) % queues_.size()]};
+      const std::lock_guard lock{q.mutex};
+      if (!q.tasks.empty()) {
+        std::function<void()> task;
+        if (i == 0) {
+          task = std::move(q.tasks.back());
+          q.tasks.pop_back();
+        } else {
+          task = std::move(q.tasks.front());
+          q.tasks.pop_front();
+        }
+        return task;
+      }
+    }
+    if (stopping_) {
+      return {};
+    }
+  }
+}
+
+}  // namespace concordo
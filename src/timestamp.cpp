@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "timestamp.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+namespace concordo {
+
+namespace ranges = std::ranges;
+
+namespace {
+
+constexpr int64_t kSecondsPerDay{86400};
+constexpr int64_t kDaysPerEra{146097}; // The Gregorian calendar repeats
+                                       // every 400 years.
+constexpr int64_t kEpochDays{719468};  // From 0000-03-01 to 1970-01-01.
+
+// The days are counted in eras starting on March 1st, so the leap day is
+// the last day of the year, and the months don't depend on the year.
+int64_t days_from_civil(int64_t y, int64_t m, int64_t d) {
+  y -= m <= 2 ? 1 : 0;
+  const int64_t era{(y >= 0 ? y : y - 399) / 400};
+  const int64_t yoe{y - era * 400};
+  const int64_t doy{(153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1};
+  const int64_t doe{yoe * 365 + yoe / 4 - yoe / 100 + doy};
+  return era * kDaysPerEra + doe - kEpochDays;
+}
+
+// Writes the last digits of a number, padded with zeros.
+char* put_digits(char* out, int64_t n, int width) {
+  for (int i{width - 1}; i >= 0; --i) {
+    out[i] = static_cast<char>('0' + n % 10);
+    n /= 10;
+  }
+  return out + width;
+}
+
+// Reads digits at fixed positions, without branching on them. Any character
+// that isn't a digit is recorded in the invalid flag, to be checked once.
+class DigitReader {
+ public:
+  explicit DigitReader(string_view s) : s_{s} {}
+
+  int read(size_t pos, size_t width) {
+    int n{0};
+    for (size_t i{pos}; i < pos + width; ++i) {
+      const unsigned d{static_cast<unsigned char>(s_[i]) - unsigned{'0'}};
+      invalid_ |= static_cast<unsigned>(d > 9);
+      n = n * 10 + static_cast<int>(d);
+    }
+    return n;
+  }
+
+  void expect(size_t pos, char c) {
+    invalid_ |= static_cast<unsigned>(s_[pos] != c);
+  }
+
+  [[nodiscard]] bool valid() const { return invalid_ == 0; }
+
+ private:
+  string_view s_;
+  unsigned invalid_{0};
+};
+
+bool in_range(const CivilTime& c) {
+  return c.month >= 1 && c.month <= 12 && c.day >= 1 && c.day <= 31 &&
+         c.hour >= 0 && c.hour < 24 && c.minute >= 0 && c.minute < 60 &&
+         c.second >= 0 && c.second < 60;
+}
+
+// Reads a number of digits, moving past it.
+bool read_number(string_view& s, int& n) {
+  const auto [p, ec]{std::from_chars(s.data(), s.data() + s.size(), n)};
+  if (ec != std::errc{} || p == s.data() || s.front() == '-') {
+    return false;
+  }
+  s.remove_prefix(static_cast<size_t>(p - s.data()));
+  return true;
+}
+
+// Moves past a separator, and the spaces around it if it allows them.
+bool skip(string_view& s, char separator, bool spaced = false) {
+  const auto skip_spaces = [&] {
+    while (spaced && !s.empty() && s.front() == ' ') {
+      s.remove_prefix(1);
+    }
+  };
+  skip_spaces();
+  if (s.empty() || s.front() != separator) {
+    return false;
+  }
+  s.remove_prefix(1);
+  skip_spaces();
+  return true;
+}
+
+}  // namespace
+
+CivilTime to_civil(time_t t) {
+  const int64_t secs{static_cast<int64_t>(t)};
+  const int64_t days{(secs >= 0 ? secs : secs - kSecondsPerDay + 1) /
+                     kSecondsPerDay};
+  const int64_t time{secs - days * kSecondsPerDay};
+
+  const int64_t z{days + kEpochDays};
+  const int64_t era{(z >= 0 ? z : z - kDaysPerEra + 1) / kDaysPerEra};
+  const int64_t doe{z - era * kDaysPerEra};
+  const int64_t yoe{(doe - doe / 1460 + doe / 36524 - doe / 146096) / 365};
+  const int64_t doy{doe - (365 * yoe + yoe / 4 - yoe / 100)};
+  const int64_t mp{(5 * doy + 2) / 153};
+  const int64_t month{mp < 10 ? mp + 3 : mp - 9};
+
+  return {static_cast<int>(yoe + era * 400 + (month <= 2 ? 1 : 0)),
+          static_cast<int>(month),
+          static_cast<int>(doy - (153 * mp + 2) / 5 + 1),
+          static_cast<int>(time / 3600),
+          static_cast<int>(time / 60 % 60),
+          static_cast<int>(time % 60)};
+}
+
+time_t from_civil(const CivilTime& c) {
+  const int64_t days{days_from_civil(c.year, c.month, c.day)};
+  return static_cast<time_t>(days * kSecondsPerDay + c.hour * 3600 +
+                             c.minute * 60 + c.second);
+}
+
+long local_offset(time_t t) {
+  // Unlike std::localtime, localtime_r doesn't share its result between the
+  // threads, and the offset spares any conversion of the date.
+  std::tm local{};
+  localtime_r(&t, &local);
+  return local.tm_gmtoff;
+}
+
+char* write_iso_time(time_t t, char* out) {
+  const CivilTime c{to_civil(t)};
+  out = put_digits(out, c.year, 4);
+  *out++ = '-';
+  out = put_digits(out, c.month, 2);
+  *out++ = '-';
+  out = put_digits(out, c.day, 2);
+  *out++ = 'T';
+  out = put_digits(out, c.hour, 2);
+  *out++ = ':';
+  out = put_digits(out, c.minute, 2);
+  *out++ = ':';
+  out = put_digits(out, c.second, 2);
+  *out++ = 'Z';
+  return out;
+}
+
+std::optional<time_t> parse_iso_time(string_view s) {
+  if (s.size() != kIsoTimeLength) {
+    return std::nullopt;
+  }
+  DigitReader r{s};
+  const CivilTime c{r.read(0, 4),  r.read(5, 2),  r.read(8, 2),
+                    r.read(11, 2), r.read(14, 2), r.read(17, 2)};
+  r.expect(4, '-');
+  r.expect(7, '-');
+  r.expect(10, 'T');
+  r.expect(13, ':');
+  r.expect(16, ':');
+  r.expect(19, 'Z');
+  if (!r.valid() || !in_range(c)) {
+    return std::nullopt;
+  }
+  return from_civil(c);
+}
+
+std::optional<time_t> parse_local_time(string_view s) {
+  CivilTime c;
+  if (!read_number(s, c.day) || !skip(s, '/') || !read_number(s, c.month) ||
+      !skip(s, '/') || !read_number(s, c.year) || !skip(s, '-', true) ||
+      !read_number(s, c.hour) || !skip(s, ':') || !read_number(s, c.minute) ||
+      !s.empty() || !in_range(c)) {
+    return std::nullopt;
+  }
+  // The offset is found at the date itself, and found again at the date it
+  // leads to, in case they're on different sides of a change of the offset.
+  const time_t local{from_civil(c)};
+  const time_t guess{local - local_offset(local)};
+  return local - local_offset(guess);
+}
+
+string_view TimeFormatter::format(time_t t) {
+  const time_t minute{t >= 0 ? t / 60 : (t - 59) / 60};
+  if (minute == minute_) {
+    return {buffer_.data(), length_};
+  }
+  const CivilTime c{to_civil(t + local_offset(t))};
+  char* p{buffer_.data()};
+  char* const last{buffer_.data() + buffer_.size()};
+  const auto put = [&](int n, string_view separator) {
+    p = std::to_chars(p, last, n).ptr;
+    p = ranges::copy(separator, p).out;
+  };
+  put(c.day, "/");
+  put(c.month, "/");
+  put(c.year, " - ");
+  put(c.hour, ":");
+  put(c.minute, "");
+  minute_ = minute;
+  length_ = static_cast<size_t>(p - buffer_.data());
+  return {buffer_.data(), length_};
+}
+
+string time_to_string(const time_t& t) {
+  string s(kIsoTimeLength, '\0');
+  write_iso_time(t, s.data());
+  return s;
+}
+
+time_t string_to_time(string_view s) {
+  if (const auto t{parse_iso_time(s)}) {
+    return *t;
+  }
+  return parse_local_time(s).value_or(0);
+}
+
+}  // namespace concordo
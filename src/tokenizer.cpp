@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+#include "tokenizer.h"
+
+namespace concordo {
+
+void Tokenizer::skip_spaces() {
+  const auto pos{line_.find_first_not_of(' ')};
+  line_.remove_prefix(pos == string_view::npos ? line_.size() : pos);
+}
+
+std::optional<string_view> Tokenizer::next() {
+  skip_spaces();
+  if (line_.empty()) {
+    return std::nullopt;
+  }
+  string_view token;
+  if (line_.front() == '"') {
+    // An unterminated quote extends to the end of the line.
+    const auto end{line_.find('"', 1)};
+    token = line_.substr(1, end == string_view::npos ? end : end - 1);
+    line_.remove_prefix(end == string_view::npos ? line_.size() : end + 1);
+  } else {
+    token = line_.substr(0, line_.find(' '));
+    line_.remove_prefix(token.size());
+  }
+  return token;
+}
+
+string_view Tokenizer::rest() {
+  skip_spaces();
+  string_view r{line_};
+  line_ = {};
+  if (r.size() >= 2 && r.front() == '"' && r.find('"', 1) == r.size() - 1) {
+    r = r.substr(1, r.size() - 2);
+  }
+  return r;
+}
+
+string_view Tokenizer::raw() {
+  if (line_.starts_with(' ')) {
+    line_.remove_prefix(1);
+  }
+  const string_view r{line_};
+  line_ = {};
+  return r;
+}
+
+bool Tokenizer::empty() const {
+  return line_.find_first_not_of(' ') == string_view::npos;
+}
+
+void append_token(string& line, string_view token) {
+  if (token.empty() || token.front() == '"' ||
+      token.find(' ') != string_view::npos) {
+    line += '"';
+    line += token;
+    line += '"';
+  } else {
+    line += token;
+  }
+}
+
+}  // namespace concordo
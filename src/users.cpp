@@ -6,7 +6,7 @@
 
 namespace concordo {
 
-void User::save(fstream& f) {
+void User::save(fstream& f) const {
   f << id_ << '\n';
   f << name_ << '\n';
   f << address_ << '\n';
@@ -0,0 +1,206 @@
+// SPDX-FileCopyrightText: 2023 Fabrício Moura Jácome
+//
+// SPDX-License-Identifier: MIT
+
+// Tests of how the system recovers from a crash while it's saved.
+//
+// Usage: concordo_recovery_test
+// Every test runs on its own temporary directory. A crash is simulated by
+// putting the files back as the crash would have left them, and then starting
+// the system again. The checks that fail are reported, and make it exit with 1.
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "system.h"
+
+namespace {
+
+using concordo::System;
+using std::string, std::string_view;
+namespace fs = std::filesystem;
+
+int failures{0};
+
+void check(bool passed, string_view test, string_view what) {
+  if (!passed) {
+    ++failures;
+    std::cerr << test << ": " << what << '\n';
+  }
+}
+
+// Runs a command in the CLI, returning its output.
+string run(System& sys, string_view command, string_view args = "") {
+  std::ostringstream out;
+  std::streambuf* const previous{std::cout.rdbuf(out.rdbuf())};
+  sys.run({command, args});
+  std::cout.rdbuf(previous);
+  return out.str();
+}
+
+void write_file(const string& fn, string_view contents) {
+  std::ofstream f{fn, std::ios::trunc};
+  f << contents;
+}
+
+size_t count(string_view text, string_view what) {
+  size_t n{0};
+  for (size_t i{text.find(what)}; i != string_view::npos;
+       i = text.find(what, i + what.size())) {
+    ++n;
+  }
+  return n;
+}
+
+// Moves to an empty directory holding empty snapshot files.
+void enter_directory(const string& test) {
+  const fs::path dir{fs::temp_directory_path() / "concordo_recovery_test" /
+                     test};
+  fs::current_path(fs::temp_directory_path());
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  fs::current_path(dir);
+  write_file("users.txt", "");
+  write_file("servers.txt", "");
+}
+
+void enter_channel(System& sys) {
+  run(sys, "login", "a@a.com pw");
+  run(sys, "enter-server", "s");
+  run(sys, "enter-channel", "c");
+}
+
+// Creates a user, a server, a channel and a message, in the journal.
+void populate(System& sys) {
+  run(sys, "create-user", "a@a.com pw Alice");
+  run(sys, "login", "a@a.com pw");
+  run(sys, "create-server", "s");
+  run(sys, "enter-server", "s");
+  run(sys, "create-channel", "c text");
+  run(sys, "enter-channel", "c");
+  run(sys, "send-message", "hi");
+  run(sys, "disconnect");
+}
+
+// The records written before they were numbered are always replayed, so the
+// users already saved must not be created again.
+void test_unnumbered_record_of_saved_user() {
+  const string test{"unnumbered record of a saved user"};
+  enter_directory("unnumbered");
+  write_file("users.txt", "1\n1\nAlice\na@a.com\npw\n");
+  write_file("journal.txt", "create-user 1 a@a.com pw Alice\n");
+  System sys;
+  sys.start();
+  run(sys, "create-user", "c@c.com pw Carol");
+  check(sys.get_user_name(1) == "Alice", test, "Alice isn't user 1");
+  check(sys.get_user_name(2) == "Carol", test, "Carol isn't user 2");
+  check(sys.find_user(3) == nullptr, test, "there is a user 3");
+}
+
+// A crash after the files of a compaction were replaced, but before the
+// journal was discarded, leaves the records the files hold in the journal.
+void test_compacted_journal_kept() {
+  const string test{"compacted journal kept"};
+  enter_directory("compacted");
+  {
+    System sys;
+    sys.start();
+    populate(sys);
+    fs::copy_file("journal.txt", "journal.txt.crash");
+    sys.compact();
+  }
+  fs::rename("journal.txt.crash", "journal.txt");
+  System sys;
+  sys.start();
+  check(sys.find_user(2) == nullptr, test, "a user was created twice");
+  enter_channel(sys);
+  check(count(run(sys, "list-messages"), ": hi\n") == 1, test,
+        "the message isn't listed once");
+  run(sys, "disconnect");
+  run(sys, "create-user", "b@b.com pw Bob");
+  check(sys.get_user_name(2) == "Bob", test, "Bob isn't user 2");
+}
+
+// A crash after a save was committed, but before every file was replaced,
+// leaves the files of both saves, and commit.txt listing the new ones.
+void test_commit_not_finished() {
+  const string test{"commit not finished"};
+  enter_directory("committed");
+  string commit;
+  {
+    System sys;
+    sys.start();
+    run(sys, "create-user", "a@a.com pw Alice");
+    sys.compact();
+    fs::copy_file("servers.txt", "servers.txt.crash");
+    run(sys, "create-user", "b@b.com pw Bob");
+    run(sys, "login", "b@b.com pw");
+    run(sys, "create-server", "s2");
+    fs::copy_file("journal.txt", "journal.txt.crash");
+    sys.compact();
+    std::ifstream f{"commit.txt"};
+    getline(f, commit);
+  }
+  // users.txt was replaced, but not servers.txt.
+  fs::rename("servers.txt", "servers.txt.tmp");
+  fs::rename("servers.txt.crash", "servers.txt");
+  fs::rename("journal.txt.crash", "journal.txt");
+  write_file("commit.txt",
+             commit + "\n2\nusers.txt\nservers.txt\n1\nretention.txt\n");
+  {
+    System sys;
+    sys.start();
+    check(sys.get_user_name(2) == "Bob", test, "Bob isn't user 2");
+    check(sys.find_user(3) == nullptr, test, "a user was created twice");
+    run(sys, "login", "b@b.com pw");
+    check(count(run(sys, "list-servers"), "s2\n") == 1, test,
+          "the server isn't listed once");
+    run(sys, "create-user", "c@c.com pw Carol");
+  }
+  check(!fs::exists("servers.txt.tmp"), test, "servers.txt wasn't replaced");
+  // The next save isn't mistaken for the one finished.
+  write_file("servers.txt.tmp", "");
+  System sys;
+  sys.start();
+  run(sys, "login", "b@b.com pw");
+  check(count(run(sys, "list-servers"), "s2\n") == 1, test,
+        "the server isn't listed once after a restart");
+}
+
+// A crash while the journal was set aside by a background save, after the
+// records were joined to the ones set aside before, but before the journal was
+// truncated, leaves them in both files.
+void test_rotation_not_finished() {
+  const string test{"rotation not finished"};
+  enter_directory("rotated");
+  {
+    System sys;
+    sys.set_background_saves(true);
+    sys.start();
+    populate(sys);
+  }
+  fs::copy_file("journal.txt", "journal.txt.old");
+  System sys;
+  sys.start();
+  check(sys.find_user(2) == nullptr, test, "a user was created twice");
+  enter_channel(sys);
+  check(count(run(sys, "list-messages"), ": hi\n") == 1, test,
+        "the message isn't listed once");
+}
+
+}  // namespace
+
+int main() {
+  const fs::path previous{fs::current_path()};
+  test_unnumbered_record_of_saved_user();
+  test_compacted_journal_kept();
+  test_commit_not_finished();
+  test_rotation_not_finished();
+  fs::current_path(previous);
+  fs::remove_all(fs::temp_directory_path() / "concordo_recovery_test");
+  return failures == 0 ? 0 : 1;
+}